@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Accumulator.hpp"
+#include "Benchmark.hpp"
+#include "Camera.hpp"
+#include "Integrator.hpp"
+#include "Material.hpp"
+#include "Renderer.hpp"
+#include "SceneFile.hpp"
+#include "World.hpp"
+#include "color.hpp"
+#include "common.hpp"
+
+// The standard scenes. Every one is fixed down to its random seeds, and
+// renders with the same image size and sample count, so results from
+// different builds and machines compare.
+struct BenchScene {
+  const char* name;
+  const char* file;
+};
+
+const BenchScene catalog[] = {
+    {"random_spheres", "scenes/random_spheres.scene"},
+    {"solar_system", "scenes/solar_system.scene"},
+    {"dense_field", "scenes/bench/dense_field.scene"},
+    {"heavy_glass", "scenes/bench/heavy_glass.scene"},
+    {"many_lights", "scenes/bench/many_lights.scene"},
+};
+
+// What a run measured for one scene.
+struct BenchResult {
+  std::string name;
+  int width = 0;
+  int height = 0;
+  unsigned samples_per_pixel = 0;
+  int max_depth = 0;
+  size_t primitives = 0;
+  double load_seconds = 0;
+  double build_seconds = 0;
+  Timings render;
+  uint64_t image_hash = 0;
+
+  // Camera rays per second at the median time, in millions.
+  double mrays_per_second() const {
+    double rays = static_cast<double>(width) * height * samples_per_pixel;
+    return render.median() > 0 ? rays / render.median() / 1e6 : 0;
+  }
+
+  JsonRecord record(int threads) const {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(image_hash));
+    JsonRecord r;
+    r.add("scene", name)
+        .add("width", width)
+        .add("height", height)
+        .add("samples", samples_per_pixel)
+        .add("depth", max_depth)
+        .add("threads", threads)
+        .add("primitives", primitives)
+        .add("load_seconds", load_seconds)
+        .add("build_seconds", build_seconds)
+        .add("median_seconds", render.median())
+        .add("p10_seconds", render.percentile(10))
+        .add("p90_seconds", render.percentile(90))
+        .add("min_seconds", render.min())
+        .add("max_seconds", render.max())
+        .add("mean_seconds", render.mean())
+        .add("stddev_seconds", render.stddev())
+        .add("camera_mrays_per_second", mrays_per_second())
+        .add("image_hash", hash)
+        .add("runs", render.seconds());
+    return r;
+  }
+};
+
+// Hash of the rendered image, to tell whether a change altered the output.
+uint64_t image_hash(const Accumulator& accumulator) {
+  std::vector<Color> pixels(accumulator.pixel_count());
+  accumulator.resolve(pixels, nullptr);
+  uint64_t hash = 0;
+  for (const Color& pixel : pixels) {
+    for (int c = 0; c < 3; ++c) {
+      double value = pixel[c];
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      hash = mix_seed(hash, bits);
+    }
+  }
+  return hash;
+}
+
+// Loads scene, building its BVH rather than mapping a cache, applies
+// settings and describes it in result.
+bool load_scene(const BenchScene& bench_scene,
+                const std::vector<std::string>& settings, World& world,
+                BenchResult& result) {
+  if (!load_world(bench_scene.file, world, false)) {
+    return false;
+  }
+  Scene& scene = world.scene;
+  for (const std::string& line : settings) {
+    std::string message;
+    if (!SceneLoader::apply_setting(line, scene, message)) {
+      std::cerr << line << ": " << message << "\n";
+      return false;
+    }
+  }
+
+  result.name = bench_scene.name;
+  result.width = scene.image_width;
+  result.height = scene.image_height;
+  result.samples_per_pixel = scene.samples_per_pixel;
+  result.max_depth = scene.max_depth;
+  result.primitives = scene.primitive_count;
+  result.load_seconds = world.load_seconds;
+  result.build_seconds = world.build_seconds;
+  return true;
+}
+
+// Renders world once with renderer and returns the time it took.
+double render(const World& world, Renderer& renderer,
+              Accumulator& accumulator) {
+  const Scene& scene = world.scene;
+  RenderContext context = make_context(world, *world.background, scene.vfov,
+                                       scene.image_height, nullptr);
+  RenderJob job(context, scene.camera(),
+                Accumulator(scene.image_width, scene.image_height));
+  job.max_depth = scene.max_depth;
+  job.samples_per_pixel = job.pass_samples = scene.samples_per_pixel;
+
+  auto start = std::chrono::steady_clock::now();
+  accumulator = renderer.submit(std::move(job)).get();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Loads scene and renders it warmup + repetitions times with renderer.
+bool run_scene(const BenchScene& bench_scene,
+               const std::vector<std::string>& settings, int warmup,
+               int repetitions, Renderer& renderer, BenchResult& result) {
+  World world;
+  if (!load_scene(bench_scene, settings, world, result)) {
+    return false;
+  }
+  for (int run = 0; run < warmup + repetitions; ++run) {
+    Accumulator accumulator;
+    double seconds = render(world, renderer, accumulator);
+    if (run >= warmup) {
+      result.render.add(seconds);
+    }
+    if (run == 0) {
+      result.image_hash = image_hash(accumulator);
+    }
+  }
+  return true;
+}
+
+// How a render spread over the threads of a renderer.
+struct ThreadUse {
+  int threads = 0;
+  Timings render;
+  // Of the run closest to the median time.
+  double seconds = 0;
+  std::vector<double> busy_seconds;
+  std::vector<double> idle_seconds;
+  double finish_spread = 0;  // between the first and last thread done
+
+  double busy_fraction() const {
+    double busy = 0;
+    for (double seconds : busy_seconds) {
+      busy += seconds;
+    }
+    double available = seconds * busy_seconds.size();
+    return available > 0 ? busy / available : 0;
+  }
+};
+
+// Renders world repetitions times with each of thread_counts threads.
+std::vector<ThreadUse> scaling_study(const World& world,
+                                     const std::vector<int>& thread_counts,
+                                     int warmup, int repetitions) {
+  std::vector<ThreadUse> study;
+  for (int threads : thread_counts) {
+    Renderer renderer(threads);
+    ThreadUse use;
+    use.threads = threads;
+    double median_distance = infinity;
+    std::vector<std::vector<ThreadStats>> runs;
+    std::vector<double> run_seconds;
+    std::vector<std::chrono::steady_clock::time_point> run_starts;
+    for (int run = 0; run < warmup + repetitions; ++run) {
+      renderer.reset_thread_stats();
+      Accumulator accumulator;
+      auto start = std::chrono::steady_clock::now();
+      double seconds = render(world, renderer, accumulator);
+      if (run >= warmup) {
+        use.render.add(seconds);
+        runs.push_back(renderer.thread_stats());
+        run_seconds.push_back(seconds);
+        run_starts.push_back(start);
+      }
+    }
+
+    for (size_t r = 0; r < runs.size(); ++r) {
+      double distance = std::abs(run_seconds[r] - use.render.median());
+      if (distance >= median_distance) {
+        continue;
+      }
+      median_distance = distance;
+      use.seconds = run_seconds[r];
+      use.busy_seconds.clear();
+      use.idle_seconds.clear();
+      double first_done = infinity;
+      double last_done = 0;
+      for (const ThreadStats& stats : runs[r]) {
+        double done = stats.tiles == 0
+                          ? 0
+                          : std::chrono::duration<double>(stats.last_tile -
+                                                          run_starts[r])
+                                .count();
+        use.busy_seconds.push_back(stats.busy_seconds);
+        use.idle_seconds.push_back(
+            std::max(0.0, run_seconds[r] - stats.busy_seconds));
+        first_done = std::min(first_done, done);
+        last_done = std::max(last_done, done);
+      }
+      use.finish_spread = last_done - first_done;
+    }
+    study.push_back(use);
+  }
+  return study;
+}
+
+// Compares results with the scene records of baseline_file and prints a
+// line per scene. Returns false when a scene got slower than tolerance
+// allows.
+bool compare(const std::vector<BenchResult>& results, int threads,
+             const std::string& baseline_file, double tolerance) {
+  std::map<std::string, std::map<std::string, std::string>> baseline;
+  for (const auto& record : read_json_records(baseline_file)) {
+    auto scene = record.find("scene");
+    if (scene != record.end()) {
+      baseline[scene->second] = record;
+    }
+  }
+  if (baseline.empty()) {
+    std::cerr << "No results in baseline " << baseline_file << ".\n";
+    return false;
+  }
+
+  bool ok = true;
+  std::cout << "\nCompared with " << baseline_file << " (tolerance "
+            << tolerance * 100 << "%):\n";
+  for (const BenchResult& result : results) {
+    auto found = baseline.find(result.name);
+    if (found == baseline.end()) {
+      printf("  %-16s not in baseline\n", result.name.c_str());
+      continue;
+    }
+    auto& base = found->second;
+    auto value = [&](const char* key) {
+      auto field = base.find(key);
+      return field == base.end() ? 0.0 : std::atof(field->second.c_str());
+    };
+    if (value("width") != result.width || value("height") != result.height ||
+        value("samples") != result.samples_per_pixel ||
+        value("threads") != threads) {
+      printf("  %-16s not comparable: other image size, samples or threads\n",
+             result.name.c_str());
+      continue;
+    }
+
+    double before = value("median_seconds");
+    double after = result.render.median();
+    double change = before > 0 ? after / before - 1 : 0;
+    const char* verdict = "same";
+    if (change > tolerance) {
+      verdict = "REGRESSION";
+      ok = false;
+    } else if (change < -tolerance) {
+      verdict = "faster";
+    }
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(result.image_hash));
+    bool image_changed = base["image_hash"] != hash;
+    printf("  %-16s %8.3f s -> %8.3f s  %+6.1f%%  %s%s\n",
+           result.name.c_str(), before, after, change * 100, verdict,
+           image_changed ? "  (image changed)" : "");
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  // Usage: Bench [--repetitions <n>] [--warmup <n>] [--threads <n>]
+  //              [--scenes <name>,<name>...] [--samples <n>]
+  //              [--output <results.json>]
+  //              [--compare <baseline.json> [--tolerance <fraction>]]
+  //        Bench --scaling [--max-threads <n>] [the options above]
+  //
+  // Renders every scene of the catalog, or the named ones, warmup times
+  // untimed and then repetitions times, and prints the median, the 10th and
+  // 90th percentile and camera rays per second. --output writes the results
+  // as JSON, one line per scene; --compare checks them against such a file
+  // and exits with 1 when a scene's median got slower by more than the
+  // tolerance, 5% unless given.
+  //
+  // --scaling renders every scene with 1, 2, 4... threads up to max-threads,
+  // hardware_concurrency() unless given, and prints the speedup over one
+  // thread, the parallel efficiency, the share of the time threads spent
+  // rendering tiles, and how far apart the first and the last thread ran
+  // out of tiles.
+  int repetitions = 5;
+  int warmup = 1;
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned samples_per_pixel = 8;
+  std::string only;
+  std::string output_file;
+  std::string baseline_file;
+  double tolerance = 0.05;
+  bool scaling = false;
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int a = 1; a < argc; ++a) {
+    std::string arg = argv[a];
+    bool has_value = a + 1 < argc;
+    if (arg == "--repetitions" && has_value) {
+      repetitions = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--warmup" && has_value) {
+      warmup = std::max(0, std::atoi(argv[++a]));
+    } else if (arg == "--threads" && has_value) {
+      num_threads = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--samples" && has_value) {
+      samples_per_pixel = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--scenes" && has_value) {
+      only = "," + std::string(argv[++a]) + ",";
+    } else if (arg == "--output" && has_value) {
+      output_file = argv[++a];
+    } else if (arg == "--compare" && has_value) {
+      baseline_file = argv[++a];
+    } else if (arg == "--tolerance" && has_value) {
+      tolerance = std::max(0.0, std::atof(argv[++a]));
+    } else if (arg == "--scaling") {
+      scaling = true;
+    } else if (arg == "--max-threads" && has_value) {
+      max_threads = std::max(1, std::atoi(argv[++a]));
+    } else {
+      std::cerr << "Unknown option " << arg << ".\n";
+      return 1;
+    }
+  }
+
+  // Render as RayTracer does, at a size that keeps a run short.
+  Lambertian::splits = 4;
+  Metal::splits = 2;
+  Dielectric::splits = 2;
+  const std::vector<std::string> settings = {
+      "image 320 180", "samples " + std::to_string(samples_per_pixel)};
+
+  auto selected = [&](const BenchScene& bench_scene) {
+    return only.empty() || only.find("," + std::string(bench_scene.name) +
+                                     ",") != std::string::npos;
+  };
+
+  if (scaling) {
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+      thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::vector<JsonRecord> records;
+    printf("%-16s %7s %10s %8s %10s %7s %10s %10s\n", "scene", "threads",
+           "median s", "speedup", "efficiency", "busy", "idle s", "spread s");
+    for (const BenchScene& bench_scene : catalog) {
+      if (!selected(bench_scene)) {
+        continue;
+      }
+      World world;
+      BenchResult scene;
+      if (!load_scene(bench_scene, settings, world, scene)) {
+        std::cerr << "Cannot run " << bench_scene.name << ".\n";
+        return 1;
+      }
+      double one_thread = 0;
+      for (const ThreadUse& use :
+           scaling_study(world, thread_counts, warmup, repetitions)) {
+        if (use.threads == 1) {
+          one_thread = use.render.median();
+        }
+        double speedup =
+            use.render.median() > 0 ? one_thread / use.render.median() : 0;
+        double idle = 0;
+        for (double seconds : use.idle_seconds) {
+          idle += seconds / use.idle_seconds.size();
+        }
+        printf("%-16s %7d %10.4f %8.2f %9.1f%% %6.1f%% %10.4f %10.4f\n",
+               scene.name.c_str(), use.threads, use.render.median(), speedup,
+               100 * speedup / use.threads, 100 * use.busy_fraction(), idle,
+               use.finish_spread);
+        fflush(stdout);
+
+        JsonRecord record;
+        record.add("scene", scene.name)
+            .add("threads", use.threads)
+            .add("median_seconds", use.render.median())
+            .add("p10_seconds", use.render.percentile(10))
+            .add("p90_seconds", use.render.percentile(90))
+            .add("speedup", speedup)
+            .add("efficiency", speedup / use.threads)
+            .add("busy_fraction", use.busy_fraction())
+            .add("finish_spread_seconds", use.finish_spread)
+            .add("busy_seconds", use.busy_seconds)
+            .add("idle_seconds", use.idle_seconds);
+        records.push_back(record);
+      }
+    }
+
+    if (!output_file.empty()) {
+      JsonRecord run;
+      run.add("repetitions", repetitions)
+          .add("warmup", warmup)
+          .add("max_threads", max_threads);
+      if (!write_results(output_file, run, "scaling", records)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  Renderer renderer(num_threads);
+  std::vector<BenchResult> results;
+  printf("%-16s %10s %10s %10s %10s %10s\n", "scene", "median s", "p10 s",
+         "p90 s", "Mrays/s", "build s");
+  for (const BenchScene& bench_scene : catalog) {
+    if (!selected(bench_scene)) {
+      continue;
+    }
+    BenchResult result;
+    if (!run_scene(bench_scene, settings, warmup, repetitions, renderer,
+                   result)) {
+      std::cerr << "Cannot run " << bench_scene.name << ".\n";
+      return 1;
+    }
+    printf("%-16s %10.4f %10.4f %10.4f %10.3f %10.4f\n", result.name.c_str(),
+           result.render.median(), result.render.percentile(10),
+           result.render.percentile(90), result.mrays_per_second(),
+           result.build_seconds);
+    fflush(stdout);
+    results.push_back(result);
+  }
+
+  if (!output_file.empty()) {
+    JsonRecord run;
+    run.add("repetitions", repetitions)
+        .add("warmup", warmup)
+        .add("threads", num_threads);
+    std::vector<JsonRecord> records;
+    for (const BenchResult& result : results) {
+      records.push_back(result.record(num_threads));
+    }
+    if (!write_results(output_file, run, "scenes", records)) {
+      return 1;
+    }
+  }
+
+  if (!baseline_file.empty() &&
+      !compare(results, num_threads, baseline_file, tolerance)) {
+    return 1;
+  }
+  return 0;
+}
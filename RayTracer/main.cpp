@@ -1,18 +1,39 @@
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
-#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "Accumulator.hpp"
 #include "Bvh.hpp"
 #include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Distributed.hpp"
+#include "EnvironmentMap.hpp"
+#include "FlatScene.hpp"
+#include "FrameQueue.hpp"
 #include "HittableList.hpp"
 #include "Image.hpp"
+#include "LightTree.hpp"
+#include "LruCache.hpp"
 #include "Material.hpp"
+#include "PathGuide.hpp"
+#include "PrimaryHitCache.hpp"
 #include "Ray.hpp"
-#include "Sphere.hpp"
-#include "Texture.hpp"
+#include "RenderServer.hpp"
+#include "Renderer.hpp"
+#include "SceneFile.hpp"
+#include "TileCosts.hpp"
+#include "TileWorld.hpp"
+#include "TraceStats.hpp"
 #include "Vec3.hpp"
+#include "World.hpp"
 #include "color.hpp"
 #include "common.hpp"
 
@@ -27,213 +48,570 @@ void print_progress(double percentage) {
   fflush(stdout);
 }
 
-Color ray_color(const Ray& r, const Color& background, const Hittable& world,
-                int depth) {
-  HitRecord rec;
-
-  // If we've exceeded the ray bounce limit, no more light is gathered.
-  if (depth <= 0) {
-    return Color(0, 0, 0);
-  }
+void print_load(const World& world) {
+  std::cout << (world.mapped ? "Mapped " : "Loaded ")
+            << world.scene.primitive_count << " primitives and "
+            << world.scene.material_count << " materials in "
+            << world.load_seconds << " s\n";
+}
 
-  // If the ray hits nothing, return the background color.
-  if (!world.hit(r, 0.001, infinity, rec)) {
-    return background;
+// True for a relative path that stays below the directory it is relative
+// to: no leading '/' and no ".." component.
+bool contained_path(const std::string& path) {
+  if (path.empty() || path[0] == '/') {
+    return false;
   }
-
-  Ray scattered;
-  Color attenuation;
-  Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-  if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-    return emitted;
+  size_t begin = 0;
+  while (begin <= path.size()) {
+    size_t end = std::min(path.find('/', begin), path.size());
+    if (path.compare(begin, end - begin, "..") == 0) {
+      return false;
+    }
+    begin = end + 1;
   }
-  return emitted +
-         attenuation * ray_color(scattered, background, world, depth - 1);
-}
-
-Color sample_pixel(const int& x, const int& y, const int& width,
-                   const int& height, const Camera& camera,
-                   const Color& background, const Hittable& world,
-                   const int& depth) {
-  auto u = (x + random_double()) / (width - 1);
-  auto v = (y + random_double()) / (height - 1);
-  Ray r = camera.get_ray(u, v);
-  return ray_color(r, background, world, depth);
+  return true;
 }
 
-HittableList random_scene() {
-  HittableList world;
-
-  auto checker =
-      make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-  auto ground_material = make_shared<Lambertian>(checker);
-  world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground_material));
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      auto choose_material = random_double();
-      Point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-      if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
-        shared_ptr<Material> sphere_material;
-
-        if (choose_material < 0.8) {
-          // diffuse
-          auto albedo = Color::random() * Color::random();
-          sphere_material = make_shared<Lambertian>(albedo);
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-        } else if (choose_material < 0.95) {
-          // Metal
-          auto albedo = Color::random(0.5, 1);
-          auto fuzz = random_double(0, 0.5);
-          sphere_material = make_shared<Metal>(albedo, fuzz);
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-        } else if (choose_material < 0.98) {
-          // Light
-          sphere_material = make_shared<DiffuseLight>(Color::random());
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-        } else {
-          // glass
-          sphere_material = make_shared<Dielectric>(1.5);
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-        }
-      }
+// Renders a request of the render server. Scenes stay loaded in scenes
+// between requests and are loaded again once their file or a mesh, texture
+// or environment file they read changes. Images
+// are only written below output_directory.
+bool render_request(const RenderRequest& request,
+                    const std::string& output_directory,
+                    LruCache<std::string, World>& scenes, Renderer& renderer,
+                    std::string& message) {
+  if (!contained_path(request.output)) {
+    message = "output must be a relative path without ..";
+    return false;
+  }
+  struct stat info;
+  if (::stat(request.scene_file.c_str(), &info) != 0) {
+    message = "cannot open " + request.scene_file;
+    return false;
+  }
+  auto world = scenes.find(request.scene_file);
+  if (!world ||
+      world->files_stamp != files_stamp(request.scene_file, world->scene)) {
+    world = make_shared<World>();
+    if (!load_world(request.scene_file, *world)) {
+      message = "cannot load " + request.scene_file;
+      return false;
     }
+    print_load(*world);
+    world->files_stamp = files_stamp(request.scene_file, world->scene);
+    scenes.insert(request.scene_file, world);
   }
 
-  auto material1 = make_shared<Dielectric>(1.5);
-  world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-  auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-  world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-  auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-  world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-  auto sunlight = make_shared<DiffuseLight>(Color(10, 9, 8));
-  world.add(make_shared<Sphere>(Point3(80, 300, 300), 100.0, sunlight));
-
-  return HittableList(make_shared<BvhNode>(world));
+  Scene settings = world->scene;
+  for (const std::string& line : request.settings) {
+    if (!SceneLoader::apply_setting(line, settings, message)) {
+      return false;
+    }
+  }
+  // A background setting replaces the constant background, not a map.
+  EnvironmentMap constant(settings.background);
+  const EnvironmentMap& background =
+      settings.environment_file.empty() ? constant : *world->background;
+  RenderContext context = make_context(*world, background, settings.vfov,
+                                       settings.image_height, nullptr);
+
+  const int width = settings.image_width;
+  const int height = settings.image_height;
+  RenderJob job(context, settings.camera(), Accumulator(width, height));
+  job.max_depth = settings.max_depth;
+  job.samples_per_pixel = job.pass_samples = settings.samples_per_pixel;
+  Accumulator accumulator = renderer.submit(std::move(job)).get();
+
+  std::vector<Color> pixels(accumulator.pixel_count());
+  FeatureBuffers features(width, height);
+  accumulator.resolve(pixels, &features);
+  Denoiser denoiser;
+  denoiser.num_threads = renderer.thread_count();
+  denoiser.denoise(pixels, features);
+  Jpg(width, height).write(output_directory + "/" + request.output, pixels);
+  return true;
 }
 
-HittableList solar_scene() {
-  HittableList objects;
-
-  auto sun_material = make_shared<DiffuseLight>(Color(5, 1, 1));
-  objects.add(make_shared<Sphere>(Point3(0, 0, 0), 432.690, sun_material));
+int main(int argc, char* argv[]) {
+  // Usage: RayTracer [<scene file>] [--threads <n>]
+  //                  [--listen <address> [--workers <n>] | --worker <address>]
+  //        RayTracer --serve <address> [--cache <scenes>] [--threads <n>]
+  //                  [--output-dir <directory>]
+  //
+  // With --listen the process coordinates: it hands out the tiles of every
+  // pass to worker processes that connect to address, merges their results
+  // and writes the images. --workers starts n local workers for it. With
+  // --worker the process renders tiles for the coordinator at address and
+  // writes nothing. Workers must be given the same scene file. An address is
+  // <host>:<port> for TCP, where an empty host is the loopback interface,
+  // or the path of a Unix-domain socket.
+  //
+  // With --serve the process stays up and renders the jobs RenderServer
+  // receives on address, keeping the last few scenes it used loaded. Their
+  // images go below --output-dir, the working directory by default.
+  std::string scene_file = "scenes/solar_system.scene";
+  std::string listen_address;
+  std::string worker_address;
+  std::string serve_address;
+  std::string output_directory = ".";
+  int local_workers = 0;
+  int cached_scenes = 4;
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int a = 1; a < argc; ++a) {
+    std::string arg = argv[a];
+    bool has_value = a + 1 < argc;
+    if (arg == "--listen" && has_value) {
+      listen_address = argv[++a];
+    } else if (arg == "--worker" && has_value) {
+      worker_address = argv[++a];
+    } else if (arg == "--workers" && has_value) {
+      local_workers = std::max(0, std::atoi(argv[++a]));
+    } else if (arg == "--serve" && has_value) {
+      serve_address = argv[++a];
+    } else if (arg == "--output-dir" && has_value) {
+      output_directory = argv[++a];
+    } else if (arg == "--cache" && has_value) {
+      cached_scenes = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--threads" && has_value) {
+      num_threads = std::max(1, std::atoi(argv[++a]));
+    } else if (arg.rfind("--", 0) != 0) {
+      scene_file = arg;
+    } else {
+      std::cerr << "Unknown option " << arg << ".\n";
+      return 1;
+    }
+  }
+  const bool coordinator = !listen_address.empty();
+  const bool worker = !worker_address.empty();
+  if (coordinator && worker) {
+    std::cerr << "--listen and --worker exclude each other.\n";
+    return 1;
+  }
 
-  auto mercury_material = make_shared<Lambertian>(Color(120, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(40'194, 0, 0), 1.516, mercury_material));
+  // Secondary paths traced from each primary hit, per material type. Most of
+  // the noise is indirect, so splitting there allows fewer camera samples.
+  Lambertian::splits = 4;
+  Metal::splits = 2;
+  Dielectric::splits = 2;
+
+  if (!serve_address.empty()) {
+    LruCache<std::string, World> scenes(cached_scenes);
+    Renderer renderer(num_threads);
+    RenderServer server;
+    if (!server.listen(serve_address)) {
+      return 1;
+    }
+    std::cout << "Serving render jobs on " << serve_address << "\n";
+    server.serve([&](const RenderRequest& request, std::string& message) {
+      return render_request(request, output_directory, scenes, renderer,
+                            message);
+    });
+    return 0;
+  }
 
-  auto venus_material = make_shared<Lambertian>(Color(230, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(67'077, 0, 0), 3.7604, venus_material));
+  // Scene, camera and render settings come from a scene file.
+  World loaded;
+  if (!load_world(scene_file, loaded)) {
+    return 1;
+  }
+  print_load(loaded);
+  const Scene& scene = loaded.scene;
+  const Hittable& world = scene.objects;
 
-  auto earth_material = make_shared<Lambertian>(Color(1, 1, 253));
-  objects.add(
-      make_shared<Sphere>(Point3(92'960, 0, 0), 3.9588, earth_material));
+  const int image_width = scene.image_width;
+  const int image_height = scene.image_height;
+  const double total_pixels = image_height * image_width;
+  const unsigned samples_per_pixel = scene.samples_per_pixel;
+  const int max_depth = scene.max_depth;
+
+  // Path guiding learns where indirect light comes from over a few training
+  // passes of 1, 2, 4, ... samples per pixel before the final render.
+  const bool path_guiding = false;
+  const int guide_training_passes = 5;
+
+  // Albedo, normal and depth buffers guide an edge-aware denoiser that runs
+  // before the image is written. write_aovs also saves them as images.
+  const bool denoise = true;
+  const bool write_aovs = false;
+
+  // Output. stream_rows writes the raw render to a float PFM row by row as
+  // rows finish; write_hdr adds a full-range Radiance .hdr of the result.
+  // write_tile_costs adds a heatmap of the time every tile took to render,
+  // <image>_cost.jpg, and the times, samples and rays per tile in
+  // <image>_cost.csv. Only tiles rendered here count, not resumed or
+  // distributed ones.
+  const bool stream_rows = false;
+  const bool write_hdr = false;
+  const bool write_tile_costs = false;
+
+  // Progressive rendering. Samples are added in passes of pass_samples, and
+  // the accumulated state is saved to <image>.checkpoint whenever
+  // checkpoint_interval seconds have passed and once the image is done.
+  // Starting the render again resumes from the checkpoint unless the scene,
+  // the camera or the settings below changed; raising samples_per_pixel
+  // extends a finished image.
+  const unsigned pass_samples = 4;
+  const bool checkpoint = true;
+  const double checkpoint_interval = 60;  // seconds
+  const uint64_t seed = 0;
+
+  // Look development. cache_primary_hits keeps what every camera ray hit in
+  // <image>.primary, so rendering again after editing only materials,
+  // textures or lights skips tracing camera rays. The checkpoint still
+  // resumes a render whose scene did not change; after such edits its key
+  // no longer matches and the render starts over.
+  const bool cache_primary_hits = false;
+
+  // Animation. frame_count > 1 orbits the camera around look_at. Frame N is
+  // encoded and written in the background while frame N + 1 renders, with at
+  // most frames_in_flight framebuffers alive.
+  const int frame_count = 1;
+  const int frames_in_flight = 2;
 
-  auto mars_material = make_shared<Lambertian>(Color(253, 1, 1));
-  objects.add(
-      make_shared<Sphere>(Point3(155'780, 0, 0), 2.1061, mars_material));
+  // Camera
+  Camera cam = scene.camera();
+
+  auto frame_camera = [&](int frame) {
+    double angle = 2 * pi * frame / frame_count;
+    Vec3 offset = scene.look_from - scene.look_at;
+    Vec3 orbit(offset.x() * std::cos(angle) - offset.z() * std::sin(angle),
+               offset.y(),
+               offset.x() * std::sin(angle) + offset.z() * std::cos(angle));
+    return Camera(scene.look_at + orbit, scene.look_at, scene.up, scene.vfov,
+                  scene.aspect_ratio(), scene.aperture, scene.focus(),
+                  scene.shutter_open, scene.shutter_close);
+  };
 
-  auto jupiter_material = make_shared<Lambertian>(Color(10, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(460'640, 0, 0), 43.441, jupiter_material));
+  // Render
+  // The guide is learned within one process, so distributed renders go
+  // without.
+  std::unique_ptr<PathGuide> guide;
+  if (path_guiding && !coordinator && !worker) {
+    AxisAlignedBoundingBox scene_bounds;
+    if (world.bounding_box(scene_bounds)) {
+      guide = std::make_unique<PathGuide>(scene_bounds);
+    }
+  }
+  RenderContext context =
+      make_context(loaded, *loaded.background, scene.vfov, image_height,
+                   guide.get());
+
+  // What the samples of a shot depend on besides its size and seed. Its
+  // checkpoint is only resumed by a render with the same key.
+  auto checkpoint_key = [&](const Camera& camera) {
+    uint64_t key = mix_seed(scene.content_hash, camera.hash());
+    key = mix_seed(key, max_depth);
+    key = mix_seed(key, Lambertian::splits);
+    key = mix_seed(key, Metal::splits);
+    key = mix_seed(key, Dielectric::splits);
+    return mix_seed(key, guide != nullptr);
+  };
+
+  // A worker renders the tiles it is sent, the same way, until the
+  // coordinator is done.
+  if (worker) {
+    TileWorker tiles;
+    if (!tiles.connect(worker_address, image_width, image_height,
+                       scene.geometry_hash)) {
+      return 1;
+    }
+    bool served = tiles.serve([&](const TileJob& job, const uint32_t* taken,
+                                  TilePixel* pixels) {
+      if (frame_count > 1) {
+        cam = frame_camera(job.frame);
+      }
+      TileWorld tile_world(context.world,
+                           tile_frustum(cam, job.x0, job.y0, job.x1, job.y1,
+                                        image_width, image_height));
+      RenderContext tile_context = context;
+      tile_context.camera_world = &tile_world;
+      const int tile_width = job.x1 - job.x0;
+      std::vector<std::thread> threads;
+      for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+          for (int j = job.y0 + t; j < job.y1; j += num_threads) {
+            for (int i = job.x0; i < job.x1; ++i) {
+              size_t k = (j - job.y0) * tile_width + (i - job.x0);
+              unsigned count = pass_count(taken[k], job.spp, job.target_spp);
+              Color pixel_color(0, 0, 0);
+              PixelFeatures f;
+              double luminance_squared = 0;
+              take_samples(i, j, count, cam, tile_context, image_width,
+                           image_height, max_depth, job.seed, taken[k],
+                           pixel_color, luminance_squared, f);
+
+              TilePixel& p = pixels[k];
+              for (int c = 0; c < 3; ++c) {
+                p.color[c] = static_cast<float>(pixel_color[c]);
+                p.albedo[c] = static_cast<float>(f.albedo[c]);
+                p.normal[c] = static_cast<float>(f.normal[c]);
+              }
+              p.luminance_squared = static_cast<float>(luminance_squared);
+              p.depth = static_cast<float>(f.depth);
+              p.samples = count;
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    });
+    return served ? 0 : 1;
+  }
 
-  auto saturn_material = make_shared<Lambertian>(Color(10, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(909'600, 0, 0), 36.184, saturn_material));
+  // A coordinator starts its local workers, which find the scene cache the
+  // coordinator just wrote.
+  std::unique_ptr<TileCoordinator> tiles;
+  std::vector<pid_t> spawned;
+  if (coordinator) {
+    tiles = std::make_unique<TileCoordinator>();
+    if (!tiles->listen(listen_address, image_width, image_height,
+                       scene.geometry_hash)) {
+      return 1;
+    }
+    std::string threads_each =
+        std::to_string(std::max(1, num_threads / std::max(1, local_workers)));
+    for (int w = 0; w < local_workers; ++w) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        execl("/proc/self/exe", argv[0], scene_file.c_str(), "--worker",
+              listen_address.c_str(), "--threads", threads_each.c_str(),
+              static_cast<char*>(nullptr));
+        _exit(127);
+      }
+      if (pid > 0) {
+        spawned.push_back(pid);
+      }
+    }
+  }
 
-  auto uranus_material = make_shared<Lambertian>(Color(10, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(1'825'700, 0, 0), 15.759, uranus_material));
+  Renderer renderer(num_threads);
+
+  if (guide) {
+    for (int pass = 0; pass < guide_training_passes; ++pass) {
+      RenderJob training(context, cam,
+                         Accumulator(image_width, image_height,
+                                     mix_seed(seed, pass)));
+      training.max_depth = max_depth;
+      training.samples_per_pixel = training.pass_samples = 1u << pass;
+      renderer.submit(std::move(training)).get();
+      guide->refine();
+    }
+    guide->recording = false;
+    std::cout << "\nPath guide: " << guide->leaves.size() << " regions\n";
+  }
+  TraceStats::reset();
+
+  // What to render: the frames of the camera one after the other, or, for a
+  // scene with views, all views as one batch whose tiles render side by
+  // side, sharing the loaded scene and the threads.
+  struct Shot {
+    std::string name;  // of the image file, without extension
+    int frame;
+    Camera camera;
+    int width;
+    int height;
+    double vfov;
+  };
+  std::vector<std::vector<Shot>> batches;
+  if (!scene.views.empty() && tiles) {
+    std::cout << "Views are not distributed; rendering the camera.\n";
+  }
+  if (!scene.views.empty() && !tiles) {
+    batches.emplace_back();
+    for (size_t v = 0; v < scene.views.size(); ++v) {
+      const View& view = scene.views[v];
+      batches.back().push_back(
+          Shot{"img/" + scene.name + "_" + view.name, static_cast<int>(v),
+               view.camera(scene.shutter_open, scene.shutter_close),
+               view.image_width, view.image_height, view.vfov});
+    }
+  }
+  for (int frame = 0; batches.empty() && frame < frame_count; ++frame) {
+    std::string frame_name = "img/" + scene.name;
+    if (frame_count > 1) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "_%04d", frame);
+      frame_name += suffix;
+      cam = frame_camera(frame);
+    }
+    batches.push_back({Shot{frame_name, frame, cam, image_width,
+                            image_height, scene.vfov}});
+  }
 
-  auto neptune_material = make_shared<Lambertian>(Color(10, 253, 10));
-  objects.add(
-      make_shared<Sphere>(Point3(2'779'500, 0, 0), 15.299, neptune_material));
+  FrameQueue output(total_pixels, frames_in_flight);
+
+  for (const std::vector<Shot>& shots : batches) {
+    // Streams the image and saves checkpoints as passes finish.
+    struct Progress {
+      std::unique_ptr<ImageStream> stream;
+      std::string checkpoint_file;
+      std::chrono::steady_clock::time_point last_save;
+    };
+    std::vector<Progress> progress(shots.size());
+    auto pass_done = [&](size_t k, const Accumulator& accumulator) {
+      Progress& p = progress[k];
+      if (p.stream) {
+        std::vector<Color> row(accumulator.width());
+        for (int j = 0; j < accumulator.height(); ++j) {
+          for (int i = 0; i < accumulator.width(); ++i) {
+            row[i] = accumulator.mean(i, j);
+          }
+          p.stream->write_rows(j, j + 1, row.data());
+        }
+      }
 
-  return HittableList(make_shared<BvhNode>(objects));
-}
+      auto now = std::chrono::steady_clock::now();
+      bool done = accumulator.min_samples() >= samples_per_pixel;
+      if (checkpoint &&
+          (done || std::chrono::duration<double>(now - p.last_save).count() >=
+                       checkpoint_interval)) {
+        accumulator.save(p.checkpoint_file);
+        p.last_save = now;
+      }
+    };
+
+    std::vector<Accumulator> accumulators;
+    std::vector<std::unique_ptr<PrimaryHitCache>> primary_hits(shots.size());
+    std::vector<TileCosts> tile_costs(shots.size());
+    for (size_t k = 0; k < shots.size(); ++k) {
+      const Shot& shot = shots[k];
+      Progress& p = progress[k];
+      if (stream_rows) {
+        p.stream = std::make_unique<ImageStream>(
+            shot.name + "_raw", shot.width, shot.height, ImageStream::kPfm);
+      }
+      p.checkpoint_file = shot.name + ".checkpoint";
+      p.last_save = std::chrono::steady_clock::now();
+
+      accumulators.emplace_back(shot.width, shot.height,
+                                mix_seed(seed, shot.frame),
+                                checkpoint_key(shot.camera));
+      if (cache_primary_hits && !tiles) {
+        const FlatScene& spheres = *loaded.flat_scene;
+        primary_hits[k] = std::make_unique<PrimaryHitCache>(
+            spheres, shot.width, shot.height, samples_per_pixel,
+            PrimaryHitCache::key(spheres, scene.shape_hash, shot.camera.hash(),
+                                 shot.width, shot.height,
+                                 mix_seed(seed, shot.frame)));
+        if (primary_hits[k]->load(shot.name + ".primary")) {
+          std::cout << "\nReusing the primary hits of " << shot.name << "\n";
+        }
+      }
+      if (checkpoint && accumulators.back().load(p.checkpoint_file)) {
+        std::cout << "\nResuming " << shot.name << " at "
+                  << accumulators.back().min_samples()
+                  << " samples per pixel\n";
+      }
+    }
 
-int main() {
-  // Image
-  const auto aspect_ratio = 16.0 / 9.0;
-  const int image_width = 1280;
-  const int image_height = static_cast<int>(image_width / aspect_ratio);
-  const double total_pixels = image_height * image_width;
-  Jpg jpg_image(image_width, image_height);
-  std::vector<Color> pixels(total_pixels);
-  const int samples_per_pixel = 100;
-  const int max_depth = 50;
-
-  // World
-  HittableList scene;
-
-  Point3 look_from;
-  Point3 look_at;
-  auto vfov = 40.0;
-  auto aperture = 0.0;
-  std::string scene_name;
-
-  switch (2) {
-    case 1:
-      scene_name = "random_spheres";
-      scene = random_scene();
-      look_from = Point3(13, 2, 3);
-      look_at = Point3(0, 0, 0);
-      aperture = 0.1;
-      break;
-    case 2:
-      scene_name = "solar_system";
-      scene = solar_scene();
-      look_from = Point3(93'964, 0, 8);
-      look_at = Point3(0, 0, -500);
-      aperture = 0.1;
-      break;
-  }
-
-  Color background = Color(0, 0, 0);
+    if (tiles) {
+      Accumulator& accumulator = accumulators.front();
+      while (accumulator.min_samples() < samples_per_pixel) {
+        size_t done_pixels = 0;
+        tiles->render_pass(shots.front().frame, pass_samples,
+                           samples_per_pixel, accumulator, [&](size_t pixels) {
+                             done_pixels += pixels;
+                             print_progress(done_pixels / total_pixels);
+                           });
+        pass_done(0, accumulator);
+      }
+    } else {
+      std::vector<RenderJob> jobs;
+      for (size_t k = 0; k < shots.size(); ++k) {
+        const Shot& shot = shots[k];
+        jobs.emplace_back(make_context(loaded, *loaded.background, shot.vfov,
+                                       shot.height, guide.get()),
+                          shot.camera, std::move(accumulators[k]));
+        RenderJob& job = jobs.back();
+        job.context.primary_hits = primary_hits[k].get();
+        if (write_tile_costs) {
+          job.tile_costs = &tile_costs[k];
+        }
+        job.max_depth = max_depth;
+        job.samples_per_pixel = samples_per_pixel;
+        job.pass_samples = pass_samples;
+        job.on_pass = [&, k](const Accumulator& accumulator) {
+          pass_done(k, accumulator);
+        };
+      }
+      std::vector<RenderHandle> renders = renderer.submit(std::move(jobs));
+      for (size_t k = 0; k < renders.size();) {
+        if (renders[k].wait_for(std::chrono::milliseconds(100))) {
+          ++k;
+          continue;
+        }
+        size_t done = 0;
+        size_t total = 0;
+        for (const RenderHandle& render : renders) {
+          RenderStats stats = render.stats();
+          done += stats.tiles_done;
+          total += stats.tiles_total;
+        }
+        print_progress(total > 0 ? static_cast<double>(done) / total : 0.0);
+      }
+      for (size_t k = 0; k < shots.size(); ++k) {
+        accumulators[k] = renders[k].get();
+        if (primary_hits[k]) {
+          primary_hits[k]->save(shots[k].name + ".primary");
+        }
+      }
+      print_progress(1.0);
+    }
 
-  // Camera
-  Vec3 up(0, 1, 0);
-  auto distance_to_focus = (look_from - look_at).length();
+    for (size_t k = 0; k < shots.size(); ++k) {
+      const Shot& shot = shots[k];
+      std::vector<Color>& pixels = output.acquire();
+      pixels.resize(accumulators[k].pixel_count());
+      FeatureBuffers features(shot.width, shot.height);
+      accumulators[k].resolve(pixels, &features);
+      accumulators[k] = Accumulator();
+
+      if (write_aovs) {
+        Jpg aov_image(shot.width, shot.height);
+        aov_image.write(shot.name + "_albedo", features.albedo);
+        aov_image.write(shot.name + "_normal", features.normal_image());
+        aov_image.write(shot.name + "_depth", features.depth_image());
+      }
 
-  Camera cam(look_from, look_at, up, vfov, aspect_ratio, aperture,
-             distance_to_focus);
+      if (!tile_costs[k].tiles().empty()) {
+        Jpg(shot.width, shot.height)
+            .write(shot.name + "_cost", tile_costs[k].heatmap());
+        tile_costs[k].write_csv(shot.name + "_cost.csv");
+      }
 
-  // Render
-  const int num_threads = std::thread::hardware_concurrency();
-  std::vector<std::thread> threads(num_threads);
-  std::mutex pixels_mutex;
-  int progress_count = 0;
-
-  for (int t = 0; t < num_threads; ++t) {
-    threads[t] = std::thread([&, t]() {
-      for (int j = t; j < image_height; j += num_threads) {
-        for (int i = 0; i < image_width; ++i) {
-          Color pixel_color(0, 0, 0);
-          for (int s = 0; s < samples_per_pixel; ++s) {
-            pixel_color += sample_pixel(i, j, image_width, image_height, cam,
-                                        background, scene, max_depth);
-          }
+      if (denoise) {
+        Denoiser denoiser;
+        denoiser.num_threads = num_threads;
+        denoiser.denoise(pixels, features);
+      }
 
-          std::lock_guard<std::mutex> guard(pixels_mutex);
-          pixels[i + (j * image_width)] = (pixel_color / samples_per_pixel);
-          progress_count++;
+      const std::string name = shot.name;
+      const int width = shot.width;
+      const int height = shot.height;
+      output.submit(pixels, [=](const std::vector<Color>& shot_pixels) {
+        Jpg(width, height).write(name, shot_pixels);
+        if (write_hdr) {
+          Hdr(width, height).write(name, shot_pixels);
         }
-        print_progress(progress_count / total_pixels);
-      }
-    });
+      });
+    }
   }
 
-  for (auto& thread : threads) {
-    thread.join();
-  }
+  output.finish();
 
-  jpg_image.write("img/" + scene_name, pixels);
+#ifdef RAY_TRACING_STATS
+  // Counts of this process only; workers count their tiles themselves.
+  std::cout << "\n";
+  TraceStats::total().print(std::cout);
+#endif
+
+  // Closing the connections tells the workers to exit.
+  tiles.reset();
+  for (pid_t pid : spawned) {
+    waitpid(pid, nullptr, 0);
+  }
 
   return 0;
 }
@@ -0,0 +1,409 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AxisAlignedBoundingBox.hpp"
+#include "Benchmark.hpp"
+#include "Bvh.hpp"
+#include "FlatScene.hpp"
+#include "HittableList.hpp"
+#include "Image.hpp"
+#include "LinearBvh.hpp"
+#include "Material.hpp"
+#include "Ray.hpp"
+#include "Sphere.hpp"
+#include "SphereStore.hpp"
+#include "Vec3.hpp"
+#include "color.hpp"
+#include "common.hpp"
+
+// Kernels of the renderer timed alone, on fixed inputs, so a change to one
+// of them shows up in its own number instead of somewhere in a frame time.
+
+// Where kernel results go, so the compiler can not drop the work.
+volatile double sink;
+
+// A kernel: run(n) performs n iterations of ops_per_iteration operations
+// each and returns something computed from their results.
+struct Kernel {
+  const char* name;
+  size_t ops_per_iteration;
+  std::function<double(size_t)> run;
+};
+
+// What a run measured for one kernel.
+struct KernelResult {
+  std::string name;
+  size_t iterations = 0;  // per repetition
+  Timings nanoseconds;  // per operation, one entry per repetition
+
+  double ops_per_second() const {
+    return nanoseconds.median() > 0 ? 1e9 / nanoseconds.median() : 0;
+  }
+
+  JsonRecord record() const {
+    JsonRecord record;
+    record.add("kernel", name)
+        .add("ns_per_op", nanoseconds.median())
+        .add("p10_ns_per_op", nanoseconds.percentile(10))
+        .add("p90_ns_per_op", nanoseconds.percentile(90))
+        .add("ops_per_second", ops_per_second())
+        .add("iterations", iterations)
+        .add("repetitions", nanoseconds.count());
+    return record;
+  }
+};
+
+// Fixed inputs: rays from all around towards a unit cube at the origin,
+// boxes and spheres in and around it, and the hits of the rays on spheres.
+struct Inputs {
+  static const size_t count = 4096;  // a power of two, for cycling through
+  std::vector<Ray> rays;
+  std::vector<AxisAlignedBoundingBox> boxes;
+  std::vector<LinearBvhNode> nodes;
+  std::vector<RayBoxTest> box_tests;
+  std::vector<Sphere> spheres;
+  std::vector<HitRecord> hits;  // materials set per kernel
+  std::vector<Ray> hit_rays;    // the ray of each hit
+
+  Inputs() {
+    seed_random(1);
+    for (size_t i = 0; i < count; ++i) {
+      Point3 origin = 5 * random_unit_vector();
+      Point3 target = Vec3::random(-1, 1);
+      rays.emplace_back(origin, target - origin);
+      box_tests.emplace_back(rays.back());
+
+      Point3 corner = Vec3::random(-1.5, 1);
+      boxes.emplace_back(corner, corner + Vec3::random(0.1, 0.5));
+      LinearBvhNode node{};
+      LinearBvh::store_bounds(boxes.back(), node);
+      nodes.push_back(node);
+
+      spheres.emplace_back(Vec3::random(-1, 1), random_double(0.1, 0.5),
+                           nullptr);
+    }
+
+    // Hits on a unit sphere, seen from the rays' origins.
+    Sphere unit(Point3(0, 0, 0), 1, nullptr);
+    for (const Ray& r : rays) {
+      HitRecord rec;
+      if (unit.hit(r, 0.001, infinity, rec)) {
+        hits.push_back(rec);
+        hit_rays.push_back(r);
+      }
+    }
+  }
+};
+
+// Rays from above the sphere field of generate_sphere_field() down into it.
+std::vector<Ray> field_rays(size_t spheres) {
+  double half = 0.5 * std::ceil(std::sqrt(static_cast<double>(spheres)));
+  std::vector<Ray> rays;
+  seed_random(2);
+  for (size_t i = 0; i < Inputs::count; ++i) {
+    Point3 origin(random_double(-half, half), 2, random_double(-half, half));
+    Vec3 direction(random_double(-1, 1), -1, random_double(-1, 1));
+    rays.emplace_back(origin, direction);
+  }
+  return rays;
+}
+
+// The kernels, with their inputs, which they keep alive.
+std::vector<Kernel> make_kernels() {
+  const size_t mask = Inputs::count - 1;
+  auto in = std::make_shared<Inputs>();
+  std::vector<Kernel> kernels;
+
+  kernels.push_back({"aabb_hit", 1, [in, mask](size_t n) {
+                       double hits = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         hits += in->boxes[i & mask].hit(
+                             in->rays[(i * 7) & mask], 0.001, infinity);
+                       }
+                       return hits;
+                     }});
+  kernels.push_back({"ray_box_test", 1, [in, mask](size_t n) {
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         double t_enter = 0;
+                         if (in->box_tests[(i * 7) & mask].hit(
+                                 in->nodes[i & mask], 0.001, infinity,
+                                 t_enter)) {
+                           sum += t_enter;
+                         }
+                       }
+                       return sum;
+                     }});
+  kernels.push_back({"sphere_hit", 1, [in, mask](size_t n) {
+                       double sum = 0;
+                       HitRecord rec;
+                       for (size_t i = 0; i < n; ++i) {
+                         if (in->spheres[i & mask].hit(
+                                 in->rays[(i * 7) & mask], 0.001, infinity,
+                                 rec)) {
+                           sum += rec.t;
+                         }
+                       }
+                       return sum;
+                     }});
+
+  // Closest hits in the sphere field, through a tree of BvhNodes over
+  // Sphere objects and through the flat BVH of FlatScene.
+  for (size_t count : {size_t(1000), size_t(100000)}) {
+    SphereStore store;
+    generate_sphere_field(store, count, 0, 1);
+    HittableList list;
+    for (size_t i = 0; i < store.size(); ++i) {
+      list.add(store.object(i));
+    }
+    auto tree = std::make_shared<BvhNode>(list);
+    auto flat = std::make_shared<FlatScene>();
+    flat->build(store);
+    auto rays = std::make_shared<std::vector<Ray>>(field_rays(count));
+
+    auto hit_all = [rays, mask](const Hittable& world, size_t n) {
+      double sum = 0;
+      HitRecord rec;
+      for (size_t i = 0; i < n; ++i) {
+        if (world.hit((*rays)[i & mask], 0.001, infinity, rec)) {
+          sum += rec.t;
+        }
+      }
+      return sum;
+    };
+    bool small = count == 1000;
+    kernels.push_back({small ? "bvh_node_hit_1k" : "bvh_node_hit_100k", 1,
+                       [tree, hit_all](size_t n) {
+                         return hit_all(*tree, n);
+                       }});
+    kernels.push_back({small ? "flat_scene_hit_1k" : "flat_scene_hit_100k", 1,
+                       [flat, hit_all](size_t n) {
+                         return hit_all(*flat, n);
+                       }});
+  }
+
+  kernels.push_back({"random_unit_vector", 1, [](size_t n) {
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         sum += random_unit_vector().x();
+                       }
+                       return sum;
+                     }});
+  kernels.push_back({"random_in_unit_sphere", 1, [](size_t n) {
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         sum += random_in_unit_sphere().x();
+                       }
+                       return sum;
+                     }});
+  kernels.push_back({"random_in_unit_disk", 1, [](size_t n) {
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         sum += random_in_unit_disk().x();
+                       }
+                       return sum;
+                     }});
+
+  // Material::scatter of every material at the hits on the unit sphere.
+  const std::pair<const char*, shared_ptr<Material>> materials[] = {
+      {"scatter_lambertian", make_shared<Lambertian>(Color(0.5, 0.5, 0.5))},
+      {"scatter_metal", make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.2)},
+      {"scatter_dielectric", make_shared<Dielectric>(1.5)},
+      {"scatter_diffuse_light", make_shared<DiffuseLight>(Color(4, 4, 4))},
+  };
+  for (const auto& [name, material] : materials) {
+    auto hits = std::make_shared<std::vector<HitRecord>>(in->hits);
+    for (HitRecord& rec : *hits) {
+      rec.mat_ptr = material;
+    }
+    kernels.push_back({name, 1, [in, hits](size_t n) {
+                         double sum = 0;
+                         Color attenuation;
+                         Ray scattered;
+                         for (size_t i = 0; i < n; ++i) {
+                           size_t k = i % hits->size();
+                           if ((*hits)[k].mat_ptr->scatter(
+                                   in->hit_rays[k], (*hits)[k], attenuation,
+                                   scattered)) {
+                             sum += scattered.direction().x();
+                           }
+                         }
+                         return sum;
+                       }});
+  }
+
+  // Jpg::write's quantization of a 1080p frame, per pixel, on one thread
+  // and spread over all of them.
+  auto frame = std::make_shared<std::vector<Color>>(1920 * 1080);
+  for (size_t i = 0; i < frame->size(); ++i) {
+    (*frame)[i] = Color(random_double(), random_double(), random_double());
+  }
+  kernels.push_back({"quantize_range", frame->size(), [frame](size_t n) {
+                       std::vector<unsigned char> data(frame->size() * 3);
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         quantize_range(frame->data(), data.data(),
+                                        frame->size());
+                         sum += data[i % data.size()];
+                       }
+                       return sum;
+                     }});
+  kernels.push_back({"jpg_quantize", frame->size(), [frame](size_t n) {
+                       double sum = 0;
+                       for (size_t i = 0; i < n; ++i) {
+                         std::vector<unsigned char> data = quantize(*frame);
+                         sum += data[i % data.size()];
+                       }
+                       return sum;
+                     }});
+  return kernels;
+}
+
+// Seconds kernel takes for n iterations. The random sequence starts over
+// every time, so every run of a sampling kernel does the same work.
+double time_kernel(const Kernel& kernel, size_t n) {
+  seed_random(3);
+  auto start = std::chrono::steady_clock::now();
+  sink = kernel.run(n);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Runs kernel with more and more iterations until a run takes min_seconds,
+// then repetitions times with that many.
+KernelResult measure(const Kernel& kernel, double min_seconds,
+                     int repetitions) {
+  KernelResult result;
+  result.name = kernel.name;
+  size_t n = 1;
+  while (time_kernel(kernel, n) < min_seconds && n < (size_t(1) << 40)) {
+    n *= 2;
+  }
+  result.iterations = n;
+  double ops = static_cast<double>(n) * kernel.ops_per_iteration;
+  for (int r = 0; r < repetitions; ++r) {
+    result.nanoseconds.add(time_kernel(kernel, n) / ops * 1e9);
+  }
+  return result;
+}
+
+// Compares results with the kernel records of baseline_file and prints a
+// line per kernel. Returns false when a kernel got slower than tolerance
+// allows.
+bool compare(const std::vector<KernelResult>& results,
+             const std::string& baseline_file, double tolerance) {
+  std::map<std::string, double> baseline;
+  for (const auto& record : read_json_records(baseline_file)) {
+    auto kernel = record.find("kernel");
+    auto ns = record.find("ns_per_op");
+    if (kernel != record.end() && ns != record.end()) {
+      baseline[kernel->second] = std::atof(ns->second.c_str());
+    }
+  }
+  if (baseline.empty()) {
+    std::cerr << "No results in baseline " << baseline_file << ".\n";
+    return false;
+  }
+
+  bool ok = true;
+  std::cout << "\nCompared with " << baseline_file << " (tolerance "
+            << tolerance * 100 << "%):\n";
+  for (const KernelResult& result : results) {
+    auto found = baseline.find(result.name);
+    if (found == baseline.end()) {
+      printf("  %-22s not in baseline\n", result.name.c_str());
+      continue;
+    }
+    double before = found->second;
+    double after = result.nanoseconds.median();
+    double change = before > 0 ? after / before - 1 : 0;
+    const char* verdict = "same";
+    if (change > tolerance) {
+      verdict = "REGRESSION";
+      ok = false;
+    } else if (change < -tolerance) {
+      verdict = "faster";
+    }
+    printf("  %-22s %10.3f ns -> %10.3f ns  %+6.1f%%  %s\n",
+           result.name.c_str(), before, after, change * 100, verdict);
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  // Usage: Microbench [--repetitions <n>] [--min-time <seconds>]
+  //                   [--kernels <text>] [--output <results.json>]
+  //                   [--compare <baseline.json> [--tolerance <fraction>]]
+  //
+  // Times every kernel, or those whose name contains the given text, and
+  // prints the median nanoseconds per operation over repetitions runs of
+  // at least min-time seconds each, 5 of 0.1 s unless given, with the 10th
+  // and 90th percentile and operations per second. --output and --compare
+  // work as for Bench; the tolerance is 10% unless given.
+  int repetitions = 5;
+  double min_seconds = 0.1;
+  std::string only;
+  std::string output_file;
+  std::string baseline_file;
+  double tolerance = 0.10;
+  for (int a = 1; a < argc; ++a) {
+    std::string arg = argv[a];
+    bool has_value = a + 1 < argc;
+    if (arg == "--repetitions" && has_value) {
+      repetitions = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--min-time" && has_value) {
+      min_seconds = std::max(0.0, std::atof(argv[++a]));
+    } else if (arg == "--kernels" && has_value) {
+      only = argv[++a];
+    } else if (arg == "--output" && has_value) {
+      output_file = argv[++a];
+    } else if (arg == "--compare" && has_value) {
+      baseline_file = argv[++a];
+    } else if (arg == "--tolerance" && has_value) {
+      tolerance = std::max(0.0, std::atof(argv[++a]));
+    } else {
+      std::cerr << "Unknown option " << arg << ".\n";
+      return 1;
+    }
+  }
+
+  std::vector<KernelResult> results;
+  printf("%-22s %12s %12s %12s %14s\n", "kernel", "ns/op", "p10 ns",
+         "p90 ns", "ops/s");
+  for (const Kernel& kernel : make_kernels()) {
+    if (std::string(kernel.name).find(only) == std::string::npos) {
+      continue;
+    }
+    KernelResult result = measure(kernel, min_seconds, repetitions);
+    printf("%-22s %12.3f %12.3f %12.3f %14.4g\n", result.name.c_str(),
+           result.nanoseconds.median(), result.nanoseconds.percentile(10),
+           result.nanoseconds.percentile(90), result.ops_per_second());
+    fflush(stdout);
+    results.push_back(result);
+  }
+
+  if (!output_file.empty()) {
+    JsonRecord run;
+    run.add("repetitions", repetitions).add("min_seconds", min_seconds);
+    std::vector<JsonRecord> records;
+    for (const KernelResult& result : results) {
+      records.push_back(result.record());
+    }
+    if (!write_results(output_file, run, "kernels", records)) {
+      return 1;
+    }
+  }
+
+  if (!baseline_file.empty() &&
+      !compare(results, baseline_file, tolerance)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,239 @@
+#ifndef _RAY_TRACING_LIB_ACCUMULATOR_HPP_
+#define _RAY_TRACING_LIB_ACCUMULATOR_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Denoiser.hpp"
+#include "color.hpp"
+#include "common.hpp"
+
+/// @brief Running sums of a progressive render: color, squared luminance and
+/// first-hit features per pixel, with the number of samples each pixel has
+/// taken so far.
+///
+/// The random sequence of every sample is seeded from (seed, pixel, sample
+/// index), so the state is fully described by the sums and the sample
+/// counts. A render resumed from a checkpoint continues exactly where the
+/// interrupted one stopped, and a finished one can be extended with more
+/// samples. The key stands for everything else the samples depend on, such
+/// as the scene, the camera and the render settings, so a checkpoint of a
+/// render that changed since is not resumed.
+class Accumulator {
+ public:
+  Accumulator() {}
+  Accumulator(int w, int h, uint64_t seed = 0, uint64_t key = 0)
+      : width_(w),
+        height_(h),
+        seed_(seed),
+        key_(key),
+        color_(pixel_count()),
+        luminance_squared_(pixel_count()),
+        albedo_(pixel_count()),
+        normal_(pixel_count()),
+        depth_(pixel_count()),
+        samples_(pixel_count()) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  uint64_t seed() const { return seed_; }
+  uint64_t key() const { return key_; }
+  size_t pixel_count() const { return static_cast<size_t>(width_) * height_; }
+
+  unsigned samples(int i, int j) const { return samples_[index(i, j)]; }
+
+  /// @brief Fewest samples taken by any pixel.
+  unsigned min_samples() const {
+    unsigned fewest = samples_.empty() ? 0 : samples_[0];
+    for (unsigned s : samples_) {
+      fewest = std::min(fewest, s);
+    }
+    return fewest;
+  }
+
+  /// @brief Seed of sample number sample of pixel number pixel, counted row
+  /// by row, for an accumulator seeded with seed. Lets a process without
+  /// the accumulator take the same samples.
+  static uint64_t pixel_seed(uint64_t seed, size_t pixel, unsigned sample) {
+    return mix_seed(mix_seed(seed, pixel), sample);
+  }
+
+  /// @brief Adds spp samples to pixel (i, j). color, luminance_squared and
+  /// features are sums over those samples. Pixels may be added from
+  /// different threads as long as no two threads share a pixel.
+  void add(int i, int j, const Color& color, double luminance_squared,
+           const PixelFeatures& features, unsigned spp) {
+    size_t p = index(i, j);
+    color_[p] += color;
+    luminance_squared_[p] += luminance_squared;
+    albedo_[p] += features.albedo;
+    normal_[p] += features.normal;
+    depth_[p] += features.depth;
+    samples_[p] += spp;
+  }
+
+  /// @brief Mean color of pixel (i, j), black before its first sample.
+  Color mean(int i, int j) const {
+    size_t p = index(i, j);
+    return samples_[p] ? color_[p] / samples_[p] : Color(0, 0, 0);
+  }
+
+  /// @brief Writes the current estimate to pixels and, when given, the mean
+  /// features and the variance of the mean luminance to features.
+  void resolve(std::vector<Color>& pixels, FeatureBuffers* features) const {
+    for (int j = 0; j < height_; ++j) {
+      for (int i = 0; i < width_; ++i) {
+        size_t p = index(i, j);
+        pixels[p] = mean(i, j);
+        if (!features || samples_[p] == 0) {
+          continue;
+        }
+
+        double n = samples_[p];
+        PixelFeatures f;
+        f.albedo = albedo_[p] / n;
+        f.normal = normal_[p] / n;
+        f.depth = depth_[p] / n;
+        double mean_luminance = luminance(pixels[p]);
+        f.variance = fmax(0.0, luminance_squared_[p] / n -
+                                   mean_luminance * mean_luminance) /
+                     n;
+        features->set(i, j, f);
+      }
+    }
+  }
+
+  /// @brief Writes a checkpoint to file_name. The file is written next to
+  /// its destination and renamed into place, so a crash while saving leaves
+  /// the previous checkpoint intact.
+  bool save(const std::string& file_name) const {
+    std::string temporary = file_name + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file) {
+        std::cerr << "Cannot write checkpoint " << temporary << ".\n";
+        return false;
+      }
+
+      Header header{kMagic, kVersion, width_, height_, seed_, key_};
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      write_floats(file, color_);
+      write_floats(file, luminance_squared_);
+      write_floats(file, albedo_);
+      write_floats(file, normal_);
+      write_floats(file, depth_);
+      file.write(reinterpret_cast<const char*>(samples_.data()),
+                 samples_.size() * sizeof(unsigned));
+      if (!file) {
+        std::cerr << "Failed writing checkpoint " << temporary << ".\n";
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), file_name.c_str()) == 0;
+  }
+
+  /// @brief Restores the state saved in file_name. Returns false, leaving
+  /// the accumulator untouched, if the file is missing or was written for a
+  /// different image size, seed or key.
+  bool load(const std::string& file_name) {
+    std::ifstream file(file_name, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+
+    Header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != kMagic || header.version != kVersion ||
+        header.width != width_ || header.height != height_ ||
+        header.seed != seed_ || header.key != key_) {
+      std::cerr << "Ignoring checkpoint " << file_name
+                << ", it does not match this render.\n";
+      return false;
+    }
+
+    Accumulator loaded(width_, height_, seed_, key_);
+    read_floats(file, loaded.color_);
+    read_floats(file, loaded.luminance_squared_);
+    read_floats(file, loaded.albedo_);
+    read_floats(file, loaded.normal_);
+    read_floats(file, loaded.depth_);
+    file.read(reinterpret_cast<char*>(loaded.samples_.data()),
+              loaded.samples_.size() * sizeof(unsigned));
+    if (!file) {
+      std::cerr << "Checkpoint " << file_name << " is truncated.\n";
+      return false;
+    }
+
+    *this = std::move(loaded);
+    return true;
+  }
+
+ private:
+  static constexpr uint32_t kMagic = 0x4b435452;  // "RTCK"
+  static constexpr uint32_t kVersion = 2;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint64_t seed;
+    uint64_t key;
+  };
+
+  size_t index(int i, int j) const {
+    return static_cast<size_t>(i) + static_cast<size_t>(j) * width_;
+  }
+
+  // The sums are kept in double while rendering but stored as 32-bit floats,
+  // which halves the checkpoint size.
+  static void write_floats(std::ofstream& file, const std::vector<Vec3>& v) {
+    std::vector<float> data(v.size() * 3);
+    for (size_t i = 0; i < v.size(); ++i) {
+      for (int c = 0; c < 3; ++c) {
+        data[3 * i + c] = static_cast<float>(v[i][c]);
+      }
+    }
+    file.write(reinterpret_cast<const char*>(data.data()),
+               data.size() * sizeof(float));
+  }
+
+  static void write_floats(std::ofstream& file, const std::vector<double>& v) {
+    std::vector<float> data(v.begin(), v.end());
+    file.write(reinterpret_cast<const char*>(data.data()),
+               data.size() * sizeof(float));
+  }
+
+  static void read_floats(std::ifstream& file, std::vector<Vec3>& v) {
+    std::vector<float> data(v.size() * 3);
+    file.read(reinterpret_cast<char*>(data.data()),
+              data.size() * sizeof(float));
+    for (size_t i = 0; i < v.size(); ++i) {
+      v[i] = Vec3(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+    }
+  }
+
+  static void read_floats(std::ifstream& file, std::vector<double>& v) {
+    std::vector<float> data(v.size());
+    file.read(reinterpret_cast<char*>(data.data()),
+              data.size() * sizeof(float));
+    v.assign(data.begin(), data.end());
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  uint64_t seed_ = 0;
+  uint64_t key_ = 0;
+  std::vector<Color> color_;
+  std::vector<double> luminance_squared_;
+  std::vector<Color> albedo_;
+  std::vector<Vec3> normal_;
+  std::vector<double> depth_;
+  std::vector<unsigned> samples_;
+};
+
+#endif  // _RAY_TRACING_LIB_ACCUMULATOR_HPP_
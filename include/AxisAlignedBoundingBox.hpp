@@ -1,6 +1,7 @@
 #ifndef _RAY_TRACING_LIB_AXIS_ALIGNED_BOUNDING_BOX_HPP_
 #define _RAY_TRACING_LIB_AXIS_ALIGNED_BOUNDING_BOX_HPP_
 
+#include "TraceStats.hpp"
 #include "common.hpp"
 
 class AxisAlignedBoundingBox {
@@ -15,6 +16,7 @@ class AxisAlignedBoundingBox {
   Point3 max() const { return maximum; }
 
   bool hit(const Ray& r, double t_min, double t_max) const {
+    TRACE_STAT(box_tests++);
     // For each axis, calculate the intersection of the ray and the min/max axis
     // boundaries. For a hit, t0, which represents the min intersection should
     // be greater than t1, which is the max intersection.
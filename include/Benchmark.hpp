@@ -0,0 +1,270 @@
+#ifndef _RAY_TRACING_LIB_BENCHMARK_HPP_
+#define _RAY_TRACING_LIB_BENCHMARK_HPP_
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Times of repeated runs of one benchmark, in seconds, and their
+/// statistics.
+class Timings {
+ public:
+  void add(double seconds) {
+    seconds_.push_back(seconds);
+    sorted_ = false;
+  }
+
+  size_t count() const { return seconds_.size(); }
+  const std::vector<double>& seconds() const { return seconds_; }
+
+  /// @brief The p-th percentile, p from 0 to 100, interpolated between the
+  /// nearest runs. 0 without runs.
+  double percentile(double p) const {
+    if (seconds_.empty()) {
+      return 0;
+    }
+    sort();
+    double position =
+        std::clamp(p, 0.0, 100.0) / 100 * (sorted_seconds_.size() - 1);
+    size_t below = static_cast<size_t>(position);
+    size_t above = std::min(below + 1, sorted_seconds_.size() - 1);
+    double fraction = position - below;
+    return sorted_seconds_[below] * (1 - fraction) +
+           sorted_seconds_[above] * fraction;
+  }
+
+  double median() const { return percentile(50); }
+  double min() const { return percentile(0); }
+  double max() const { return percentile(100); }
+
+  double mean() const {
+    double sum = 0;
+    for (double s : seconds_) {
+      sum += s;
+    }
+    return seconds_.empty() ? 0 : sum / seconds_.size();
+  }
+
+  /// @brief Sample standard deviation, 0 for fewer than two runs.
+  double stddev() const {
+    if (seconds_.size() < 2) {
+      return 0;
+    }
+    double m = mean();
+    double sum = 0;
+    for (double s : seconds_) {
+      sum += (s - m) * (s - m);
+    }
+    return std::sqrt(sum / (seconds_.size() - 1));
+  }
+
+ private:
+  void sort() const {
+    if (!sorted_) {
+      sorted_seconds_ = seconds_;
+      std::sort(sorted_seconds_.begin(), sorted_seconds_.end());
+      sorted_ = true;
+    }
+  }
+
+  std::vector<double> seconds_;
+  mutable std::vector<double> sorted_seconds_;
+  mutable bool sorted_ = false;
+};
+
+/// @brief A flat JSON object written on one line, so results files can be
+/// read back a line at a time by read_json_records().
+class JsonRecord {
+ public:
+  JsonRecord& add(const std::string& key, const std::string& value) {
+    return add_raw(key, quote(value));
+  }
+
+  JsonRecord& add(const std::string& key, const char* value) {
+    return add_raw(key, quote(value));
+  }
+
+  JsonRecord& add(const std::string& key, double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", std::isfinite(value) ? value : 0.0);
+    return add_raw(key, text);
+  }
+
+  JsonRecord& add(const std::string& key, long long value) {
+    return add_raw(key, std::to_string(value));
+  }
+
+  JsonRecord& add(const std::string& key, int value) {
+    return add(key, static_cast<long long>(value));
+  }
+
+  JsonRecord& add(const std::string& key, unsigned value) {
+    return add(key, static_cast<long long>(value));
+  }
+
+  JsonRecord& add(const std::string& key, size_t value) {
+    return add(key, static_cast<long long>(value));
+  }
+
+  JsonRecord& add(const std::string& key, const std::vector<double>& values) {
+    std::string list = "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+      char text[32];
+      snprintf(text, sizeof(text), "%s%.9g", i ? ", " : "", values[i]);
+      list += text;
+    }
+    return add_raw(key, list + "]");
+  }
+
+  /// @brief Adds a value that is JSON already, such as a nested record.
+  JsonRecord& add_raw(const std::string& key, const std::string& json) {
+    fields_ += (fields_.empty() ? "" : ", ") + quote(key) + ": " + json;
+    return *this;
+  }
+
+  std::string str() const { return "{" + fields_ + "}"; }
+
+  static std::string quote(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escape[8];
+        snprintf(escape, sizeof(escape), "\\u%04x", c);
+        quoted += escape;
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  }
+
+ private:
+  std::string fields_;
+};
+
+/// @brief The one-line objects of a file written with JsonRecord, as key
+/// to value text with strings unquoted. Other lines, and values that are
+/// arrays or objects, are skipped.
+inline std::vector<std::map<std::string, std::string>> read_json_records(
+    const std::string& file_name) {
+  std::vector<std::map<std::string, std::string>> records;
+  std::ifstream file(file_name);
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t begin = line.find_first_not_of(" \t");
+    size_t end = line.find_last_of('}');
+    if (begin == std::string::npos || line[begin] != '{' ||
+        end == std::string::npos || end <= begin) {
+      continue;
+    }
+
+    std::map<std::string, std::string> record;
+    size_t i = begin + 1;
+    auto skip_space = [&]() {
+      while (i < end && (line[i] == ' ' || line[i] == ',')) {
+        ++i;
+      }
+    };
+    auto read_string = [&](std::string& text) {
+      text.clear();
+      for (++i; i < end && line[i] != '"'; ++i) {
+        if (line[i] == '\\' && i + 1 < end) {
+          ++i;
+        }
+        text += line[i];
+      }
+      ++i;
+    };
+    while (true) {
+      skip_space();
+      if (i >= end || line[i] != '"') {
+        break;
+      }
+      std::string key;
+      std::string value;
+      read_string(key);
+      while (i < end && (line[i] == ' ' || line[i] == ':')) {
+        ++i;
+      }
+      if (i < end && line[i] == '"') {
+        read_string(value);
+      } else if (i < end && (line[i] == '[' || line[i] == '{')) {
+        // Nested values are not read; skip to the matching bracket.
+        int depth = 0;
+        for (; i < end; ++i) {
+          depth += line[i] == '[' || line[i] == '{';
+          depth -= line[i] == ']' || line[i] == '}';
+          if (depth == 0) {
+            ++i;
+            break;
+          }
+        }
+        continue;
+      } else {
+        size_t stop = line.find_first_of(",}", i);
+        value = line.substr(i, std::min(stop, end) - i);
+        i = std::min(stop, end);
+      }
+      record[key] = value;
+    }
+    if (!record.empty()) {
+      records.push_back(record);
+    }
+  }
+  return records;
+}
+
+/// @brief Where and when a benchmark ran, as a JSON record.
+inline JsonRecord machine_record() {
+  char host[256] = {};
+  if (gethostname(host, sizeof(host) - 1) != 0) {
+    snprintf(host, sizeof(host), "unknown");
+  }
+  char date[32];
+  time_t now = time(nullptr);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  JsonRecord machine;
+  machine.add("host", host);
+  machine.add("hardware_threads", std::thread::hardware_concurrency());
+#ifdef __VERSION__
+  machine.add("compiler", __VERSION__);
+#endif
+  machine.add("date", date);
+  return machine;
+}
+
+/// @brief Writes the machine, the run's settings and the records under name,
+/// one per line, as a JSON object to file_name.
+inline bool write_results(const std::string& file_name, const JsonRecord& run,
+                          const std::string& name,
+                          const std::vector<JsonRecord>& records) {
+  std::ofstream file(file_name);
+  file << "{\n  \"machine\": " << machine_record().str() << ",\n"
+       << "  \"run\": " << run.str() << ",\n  " << JsonRecord::quote(name)
+       << ": [\n";
+  for (size_t i = 0; i < records.size(); ++i) {
+    file << "    " << records[i].str()
+         << (i + 1 < records.size() ? ",\n" : "\n");
+  }
+  file << "  ]\n}\n";
+  if (!file) {
+    std::cerr << "Cannot write " << file_name << ".\n";
+    return false;
+  }
+  return true;
+}
+
+#endif  // _RAY_TRACING_LIB_BENCHMARK_HPP_
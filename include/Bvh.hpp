@@ -7,8 +7,8 @@
 #include "HittableList.hpp"
 #include "common.hpp"
 
-inline bool box_compare(const shared_ptr<Hittable> a,
-                        const shared_ptr<Hittable> b, int axis) {
+inline bool box_compare(const shared_ptr<Hittable>& a,
+                        const shared_ptr<Hittable>& b, int axis) {
   AxisAlignedBoundingBox box_a;
   AxisAlignedBoundingBox box_b;
 
@@ -19,21 +19,24 @@ inline bool box_compare(const shared_ptr<Hittable> a,
   return box_a.min().e[axis] < box_b.min().e[axis];
 }
 
-bool box_x_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
+bool box_x_compare(const shared_ptr<Hittable>& a,
+                   const shared_ptr<Hittable>& b) {
   return box_compare(a, b, 0);
 }
 
-bool box_y_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
+bool box_y_compare(const shared_ptr<Hittable>& a,
+                   const shared_ptr<Hittable>& b) {
   return box_compare(a, b, 1);
 }
 
-bool box_z_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
+bool box_z_compare(const shared_ptr<Hittable>& a,
+                   const shared_ptr<Hittable>& b) {
   return box_compare(a, b, 2);
 }
 
 class BvhNode : public Hittable {
  public:
-  BvhNode();
+  BvhNode() {}
 
   BvhNode(const HittableList& list)
       : BvhNode(list.objects, 0, list.objects.size()) {}
@@ -46,6 +49,12 @@ class BvhNode : public Hittable {
 
   virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override;
 
+ private:
+  // Builds the subtree over [start, end) of objects, sorting that range in
+  // place. Children work on disjoint ranges of the one copy.
+  void build(std::vector<shared_ptr<Hittable>>& objects, size_t start,
+             size_t end);
+
  public:
   shared_ptr<Hittable> left;
   shared_ptr<Hittable> right;
@@ -55,7 +64,11 @@ class BvhNode : public Hittable {
 BvhNode::BvhNode(const std::vector<shared_ptr<Hittable>>& src_objects,
                  size_t start, size_t end) {
   auto objects = src_objects;
+  build(objects, start, end);
+}
 
+void BvhNode::build(std::vector<shared_ptr<Hittable>>& objects, size_t start,
+                    size_t end) {
   int axis = random_int(0, 2);
   auto comparator = (axis == 0)   ? box_x_compare
                     : (axis == 1) ? box_y_compare
@@ -75,11 +88,17 @@ BvhNode::BvhNode(const std::vector<shared_ptr<Hittable>>& src_objects,
       right = objects[start];
     }
   } else {
-    std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
+    // Only the split position matters, not the order within each half.
     auto mid = start + object_span / 2;
-    left = make_shared<BvhNode>(objects, start, mid);
-    right = make_shared<BvhNode>(objects, mid, end);
+    std::nth_element(objects.begin() + start, objects.begin() + mid,
+                     objects.begin() + end, comparator);
+
+    auto left_node = make_shared<BvhNode>();
+    auto right_node = make_shared<BvhNode>();
+    left_node->build(objects, start, mid);
+    right_node->build(objects, mid, end);
+    left = left_node;
+    right = right_node;
   }
 
   AxisAlignedBoundingBox box_left, box_right;
@@ -93,6 +112,7 @@ BvhNode::BvhNode(const std::vector<shared_ptr<Hittable>>& src_objects,
 
 bool BvhNode::hit(const Ray& r, double t_min, double t_max,
                   HitRecord& rec) const {
+  TRACE_STAT(node_visits++);
   if (!box.hit(r, t_min, t_max)) {
     return false;
   }
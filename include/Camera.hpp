@@ -1,12 +1,20 @@
 #ifndef _RAY_TRACING_LIB_CAMERA_HPP_
 #define _RAY_TRACING_LIB_CAMERA_HPP_
 
+#include <cstdint>
+#include <cstring>
+
+#include "Frustum.hpp"
 #include "common.hpp"
 
 class Camera {
  public:
+  /// @brief Rays are sent at random times between shutter_open and
+  /// shutter_close, which blurs whatever moves in between.
   Camera(Point3 look_from, Point3 look_at, Vec3 up, double vertical_fov,
-         double aspect_ratio, double aperture, double focus_distance) {
+         double aspect_ratio, double aperture, double focus_distance,
+         double shutter_open = 0.0, double shutter_close = 0.0)
+      : time0(shutter_open), time1(shutter_close) {
     auto theta = degrees_to_radians(vertical_fov);
     auto h = std::tan(theta / 2);
     auto viewport_height = 2.0 * h;
@@ -29,8 +37,61 @@ class Camera {
     Vec3 rd = lens_radius * random_in_unit_circle();
     Vec3 offset = u * rd.x() + v * rd.y();
 
-    return Ray(origin + offset, top_left_corner + s * horizontal -
-                                    t * vertical - origin - offset);
+    return Ray(origin + offset,
+               top_left_corner + s * horizontal - t * vertical - origin -
+                   offset,
+               time0 == time1 ? time0 : random_double(time0, time1));
+  }
+
+  /// @brief Frustum of the rays get_ray(s, t) sends for s in [s0, s1] and t
+  /// in [t0, t1], for any point of the lens.
+  Frustum frustum(double s0, double s1, double t0, double t1) const {
+    auto focus_point = [&](double s, double t) {
+      return top_left_corner + s * horizontal - t * vertical;
+    };
+    Point3 middle = focus_point((s0 + s1) / 2, (t0 + t1) / 2);
+
+    Frustum frustum;
+    // Sides along vertical see the lens from its rims along u, sides along
+    // horizontal from its rims along v.
+    const Point3 corners[4] = {focus_point(s0, t0), focus_point(s1, t0),
+                               focus_point(s0, t0), focus_point(s0, t1)};
+    const Vec3 directions[4] = {vertical, vertical, horizontal, horizontal};
+    const Vec3 rims[4] = {u, u, v, v};
+    for (int k = 0; k < 4; ++k) {
+      for (int side = 0; side < 2; ++side) {
+        Point3 rim = origin + (side ? -lens_radius : lens_radius) * rims[k];
+        frustum.sides[k][side] =
+            Frustum::side(corners[k], directions[k], rim, middle);
+      }
+    }
+    frustum.near.normal = w;
+    frustum.near.offset = dot(w, origin);
+    frustum.direction = middle - origin;
+    return frustum;
+  }
+
+  /// @brief Equal for cameras that send the same rays for the same random
+  /// numbers.
+  uint64_t hash() const {
+    const double values[] = {origin.x(),          origin.y(),
+                             origin.z(),          top_left_corner.x(),
+                             top_left_corner.y(), top_left_corner.z(),
+                             horizontal.x(),      horizontal.y(),
+                             horizontal.z(),      vertical.x(),
+                             vertical.y(),        vertical.z(),
+                             u.x(),               u.y(),
+                             u.z(),               v.x(),
+                             v.y(),               v.z(),
+                             lens_radius,         time0,
+                             time1};
+    uint64_t hash = 0;
+    for (double value : values) {
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      hash = mix_seed(hash, bits);
+    }
+    return hash;
   }
 
  private:
@@ -40,6 +101,7 @@ class Camera {
   Vec3 vertical;
   Vec3 u, v, w;
   double lens_radius;
+  double time0, time1;  // shutter open and close times
 };
 
 #endif  // _RAY_TRACING_LIB_CAMERA_HPP_
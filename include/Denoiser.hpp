@@ -0,0 +1,197 @@
+#ifndef _RAY_TRACING_LIB_DENOISER_HPP_
+#define _RAY_TRACING_LIB_DENOISER_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "color.hpp"
+#include "common.hpp"
+
+/// @brief First-hit features averaged over a pixel's camera samples.
+struct PixelFeatures {
+  Color albedo;
+  Vec3 normal;
+  double depth = 0;  // distance to the first hit, 0 where nothing was hit
+  double variance = 0;  // variance of the pixel's mean luminance
+};
+
+/// @brief Auxiliary output variables (AOVs) written next to the color buffer
+/// and used to guide the denoiser.
+struct FeatureBuffers {
+  FeatureBuffers() {}
+  FeatureBuffers(int w, int h)
+      : width(w),
+        height(h),
+        albedo(static_cast<size_t>(w) * h),
+        normal(static_cast<size_t>(w) * h),
+        depth(static_cast<size_t>(w) * h),
+        variance(static_cast<size_t>(w) * h) {}
+
+  void set(int i, int j, const PixelFeatures& f) {
+    size_t index = static_cast<size_t>(i) + static_cast<size_t>(j) * width;
+    albedo[index] = f.albedo;
+    normal[index] = f.normal;
+    depth[index] = f.depth;
+    variance[index] = f.variance;
+  }
+
+  /// @brief Normals mapped from [-1,1] to [0,1] for writing as an image.
+  std::vector<Color> normal_image() const {
+    std::vector<Color> image(normal.size());
+    for (size_t i = 0; i < normal.size(); ++i) {
+      image[i] = 0.5 * (normal[i] + Vec3(1, 1, 1));
+    }
+    return image;
+  }
+
+  /// @brief Depth scaled to [0,1] with the nearest hit white.
+  std::vector<Color> depth_image() const {
+    double far = 0;
+    for (double d : depth) {
+      far = fmax(far, d);
+    }
+    std::vector<Color> image(depth.size());
+    for (size_t i = 0; i < depth.size(); ++i) {
+      double shade = (far > 0 && depth[i] > 0) ? 1 - depth[i] / far : 0;
+      image[i] = Color(shade, shade, shade);
+    }
+    return image;
+  }
+
+  int width = 0;
+  int height = 0;
+  std::vector<Color> albedo;
+  std::vector<Vec3> normal;
+  std::vector<double> depth;
+  std::vector<double> variance;
+};
+
+/// @brief Edge-avoiding a-trous wavelet filter, a joint bilateral filter whose
+/// 5x5 footprint doubles every iteration. Albedo, normal and depth stop the
+/// filter at geometric and texture edges. The luminance term is scaled by
+/// each pixel's estimated noise, so it smooths noise but keeps real lighting
+/// edges, and the variance estimate is filtered along with the color.
+///
+/// Lighting is filtered with the albedo divided out and multiplied back
+/// afterwards, so texture detail is not blurred along with the noise.
+class Denoiser {
+ public:
+  int iterations = 5;
+  double sigma_luminance = 4.0;  // in standard deviations of the pixel noise
+  double sigma_albedo = 0.1;     // albedo difference
+  double normal_power = 64;      // exponent on the normal dot product
+  double sigma_depth = 0.1;      // depth difference relative to the depth
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  void denoise(std::vector<Color>& pixels,
+               const FeatureBuffers& features) const {
+    const int width = features.width;
+    const int height = features.height;
+    const size_t count = pixels.size();
+
+    Layer current{std::vector<Color>(count), std::vector<double>(count)};
+    Layer next{std::vector<Color>(count), std::vector<double>(count)};
+    for (size_t i = 0; i < count; ++i) {
+      Color a = demodulation(features.albedo[i]);
+      current.color[i] = Color(pixels[i].x() / a.x(), pixels[i].y() / a.y(),
+                               pixels[i].z() / a.z());
+      double scale = luminance(a);
+      current.variance[i] = features.variance[i] / (scale * scale);
+    }
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+      int step = 1 << iteration;
+
+      std::vector<std::thread> threads(num_threads);
+      for (int t = 0; t < num_threads; ++t) {
+        threads[t] = std::thread([&, t]() {
+          for (int j = t; j < height; j += num_threads) {
+            for (int i = 0; i < width; ++i) {
+              filter_pixel(i, j, step, current, next, features);
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+
+      std::swap(current, next);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      pixels[i] = current.color[i] * demodulation(features.albedo[i]);
+    }
+  }
+
+ private:
+  struct Layer {
+    std::vector<Color> color;
+    std::vector<double> variance;
+  };
+
+  // Albedo with a floor so black surfaces do not blow up the lighting.
+  static Color demodulation(const Color& albedo) {
+    return Color(fmax(albedo.x(), 0.01), fmax(albedo.y(), 0.01),
+                 fmax(albedo.z(), 0.01));
+  }
+
+  void filter_pixel(int i, int j, int step, const Layer& in, Layer& out,
+                    const FeatureBuffers& f) const {
+    static const double kernel[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+
+    const int width = f.width;
+    const size_t center = i + static_cast<size_t>(j) * width;
+    const double l0 = luminance(in.color[center]);
+    const double sigma_l =
+        sigma_luminance * sqrt(fmax(in.variance[center], 0.0)) + 1e-8;
+
+    Color sum(0, 0, 0);
+    double variance_sum = 0;
+    double weight_sum = 0;
+
+    for (int dy = -2; dy <= 2; ++dy) {
+      int y = j + dy * step;
+      if (y < 0 || y >= f.height) {
+        continue;
+      }
+      for (int dx = -2; dx <= 2; ++dx) {
+        int x = i + dx * step;
+        if (x < 0 || x >= width) {
+          continue;
+        }
+        size_t q = x + static_cast<size_t>(y) * width;
+
+        double w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+
+        w *= std::exp(-std::fabs(luminance(in.color[q]) - l0) / sigma_l);
+
+        Vec3 da = f.albedo[q] - f.albedo[center];
+        w *= std::exp(-da.length_squared() /
+                      (2 * sigma_albedo * sigma_albedo));
+
+        if (q != center) {
+          double n_dot = dot(f.normal[q], f.normal[center]);
+          w *= std::pow(fmax(0.0, n_dot), normal_power);
+        }
+
+        double d0 = f.depth[center];
+        double d1 = f.depth[q];
+        double dd = std::fabs(d1 - d0) / fmax(fmax(d0, d1), 1e-8);
+        w *= std::exp(-(dd * dd) / (2 * sigma_depth * sigma_depth));
+
+        sum += w * in.color[q];
+        variance_sum += w * w * in.variance[q];
+        weight_sum += w;
+      }
+    }
+
+    // The center pixel always has a positive weight.
+    out.color[center] = sum / weight_sum;
+    out.variance[center] = variance_sum / (weight_sum * weight_sum);
+  }
+};
+
+#endif  // _RAY_TRACING_LIB_DENOISER_HPP_
@@ -0,0 +1,380 @@
+#ifndef _RAY_TRACING_LIB_DISTRIBUTED_HPP_
+#define _RAY_TRACING_LIB_DISTRIBUTED_HPP_
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Accumulator.hpp"
+#include "Denoiser.hpp"
+#include "Socket.hpp"
+
+// Tile rendering split across processes. A coordinator listens on a socket,
+// workers connect to it, and the coordinator hands each worker one tile of
+// the current pass at a time. A worker renders exactly the samples the
+// single-process loop would take for those pixels and returns the sums, so
+// the merged image does not depend on how many workers there were or which
+// of them died along the way.
+//
+// Messages are the plain structs below in the byte order of the machine, so
+// every process must run on the same kind of machine.
+
+/// @brief Sent by a worker when it connects, so the coordinator can turn
+/// away workers that loaded a different scene.
+struct WorkerHello {
+  static constexpr uint32_t kMagic = 0x4b575452;  // "RTWK"
+  static constexpr uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  uint64_t geometry_hash;
+};
+
+/// @brief One tile of a pass. Sent to a worker followed by the sample
+/// count of every pixel of the tile, row by row, and returned with the
+/// tile's TilePixel sums.
+struct TileJob {
+  static constexpr uint32_t kMagic = 0x4c545452;  // "RTTL"
+  static constexpr int kMaxSize = 256;
+
+  uint32_t magic;
+  int32_t frame;
+  uint64_t seed;  // of the frame's accumulator
+  int32_t x0, y0, x1, y1;
+  uint32_t spp;
+  uint32_t target_spp;
+
+  size_t pixel_count() const {
+    return static_cast<size_t>(x1 - x0) * (y1 - y0);
+  }
+
+  bool valid(int width, int height) const {
+    return magic == kMagic && x0 >= 0 && y0 >= 0 && x0 < x1 && y0 < y1 &&
+           x1 <= width && y1 <= height && x1 - x0 <= kMaxSize &&
+           y1 - y0 <= kMaxSize;
+  }
+};
+
+/// @brief Sums over the samples a worker took for one pixel.
+struct TilePixel {
+  float color[3];
+  float luminance_squared;
+  float albedo[3];
+  float normal[3];
+  float depth;
+  uint32_t samples;
+};
+
+/// @brief Hands the tiles of each pass to the connected workers and merges
+/// what they return into the accumulator.
+///
+/// Workers may connect at any time, also in the middle of a pass, and get
+/// tiles once their WorkerHello arrived. When a worker's connection fails,
+/// the tile it was working on goes back to the queue for the others. A pass
+/// waits for workers as long as it has none.
+class TileCoordinator {
+ public:
+  static constexpr int tile_size = 32;
+
+  /// @brief Listens on address for workers of an image of the given size
+  /// and scene geometry.
+  bool listen(const std::string& address, int width, int height,
+              uint64_t geometry_hash) {
+    width_ = width;
+    height_ = height;
+    geometry_hash_ = geometry_hash;
+
+    return listener_.listen(address);
+  }
+
+  size_t worker_count() const {
+    return std::count_if(
+        workers_.begin(), workers_.end(),
+        [](const Worker& worker) { return worker.introduced; });
+  }
+
+  /// @brief Adds up to spp samples to every pixel of accumulator that has
+  /// fewer than target_spp, like a local pass. progress(pixels) is called
+  /// as tiles come back.
+  template <typename Progress>
+  void render_pass(int frame, unsigned spp, unsigned target_spp,
+                   Accumulator& accumulator, Progress progress) {
+    std::deque<TileJob> queue;
+    for (int y = 0; y < height_; y += tile_size) {
+      for (int x = 0; x < width_; x += tile_size) {
+        TileJob job{TileJob::kMagic, frame, accumulator.seed(), x, y,
+                    std::min(x + tile_size, width_),
+                    std::min(y + tile_size, height_), spp, target_spp};
+        queue.push_back(job);
+      }
+    }
+
+    size_t busy = 0;
+    bool waiting = false;
+    std::vector<pollfd> polled;
+    while (!queue.empty() || busy > 0) {
+      for (Worker& worker : workers_) {
+        if (queue.empty()) {
+          break;
+        }
+        if (worker.introduced && !worker.busy && worker.connection.valid()) {
+          worker.job = queue.front();
+          queue.pop_front();
+          worker.busy = true;
+          ++busy;
+          if (!send(worker, accumulator)) {
+            drop(worker, queue, busy);
+          }
+        }
+      }
+      remove_dropped();
+
+      bool none = worker_count() == 0;
+      if (none && !waiting) {
+        std::cout << "\nWaiting for workers\n";
+      }
+      waiting = none;
+
+      polled.assign(1, pollfd{listener_.fd(), POLLIN, 0});
+      for (const Worker& worker : workers_) {
+        polled.push_back(pollfd{worker.connection.fd(), POLLIN, 0});
+      }
+      if (::poll(polled.data(), polled.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "poll failed: " << std::strerror(errno) << ".\n";
+        return;
+      }
+
+      for (size_t w = 0; w < workers_.size(); ++w) {
+        if (polled[w + 1].revents == 0) {
+          continue;
+        }
+        Worker& worker = workers_[w];
+        size_t pixels = worker.job.pixel_count();
+        if (!worker.introduced) {
+          receive_hello(worker);
+        } else if (worker.busy && receive(worker, accumulator)) {
+          worker.busy = false;
+          --busy;
+          progress(pixels);
+        } else {
+          drop(worker, queue, busy);
+        }
+      }
+      remove_dropped();
+
+      if (polled[0].revents & POLLIN) {
+        accept_worker();
+      }
+    }
+  }
+
+ private:
+  struct Worker {
+    Connection connection;
+    TileJob job{};
+    bool busy = false;
+    // Until the whole WorkerHello arrived and matched, the worker gets no
+    // tiles.
+    bool introduced = false;
+    WorkerHello hello{};
+    size_t hello_bytes = 0;
+  };
+
+  // Replies are only read once they start to arrive, so a connection that
+  // stalls in the middle of a message for this long counts as lost.
+  static constexpr int kReceiveTimeout = 10;  // seconds
+
+  // Adds the new connection as a worker that still has to introduce
+  // itself. Its hello is read as it arrives, so a slow or silent client
+  // does not hold up the tiles of the others.
+  void accept_worker() {
+    Connection connection = listener_.accept();
+    if (!connection.valid()) {
+      return;
+    }
+    timeval timeout{kReceiveTimeout, 0};
+    ::setsockopt(connection.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout));
+    workers_.emplace_back();
+    workers_.back().connection = std::move(connection);
+  }
+
+  // Reads what arrived of the worker's hello without waiting for the rest.
+  // Closes the connection if it ends first or the hello does not match.
+  void receive_hello(Worker& worker) {
+    char* p = reinterpret_cast<char*>(&worker.hello);
+    ssize_t received =
+        ::recv(worker.connection.fd(), p + worker.hello_bytes,
+               sizeof(worker.hello) - worker.hello_bytes, MSG_DONTWAIT);
+    if (received < 0 &&
+        (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (received <= 0) {
+      worker.connection.close();
+      return;
+    }
+    worker.hello_bytes += received;
+    if (worker.hello_bytes < sizeof(worker.hello)) {
+      return;
+    }
+
+    const WorkerHello& hello = worker.hello;
+    if (hello.magic != WorkerHello::kMagic ||
+        hello.version != WorkerHello::kVersion || hello.width != width_ ||
+        hello.height != height_ || hello.geometry_hash != geometry_hash_) {
+      std::cerr << "\nTurned away a worker with a different scene.\n";
+      worker.connection.close();
+      return;
+    }
+    int on = 1;
+    ::setsockopt(worker.connection.fd(), IPPROTO_TCP, TCP_NODELAY, &on,
+                 sizeof(on));
+    worker.introduced = true;
+  }
+
+  bool send(const Worker& worker, const Accumulator& accumulator) {
+    const TileJob& job = worker.job;
+    samples_.clear();
+    for (int j = job.y0; j < job.y1; ++j) {
+      for (int i = job.x0; i < job.x1; ++i) {
+        samples_.push_back(accumulator.samples(i, j));
+      }
+    }
+    return worker.connection.send_all(&job, sizeof(job)) &&
+           worker.connection.send_all(samples_.data(),
+                                      samples_.size() * sizeof(uint32_t));
+  }
+
+  // Merges the returned tile. False, merging nothing, if the reply is cut
+  // off or does not match the tile that was sent.
+  bool receive(const Worker& worker, Accumulator& accumulator) {
+    const TileJob& job = worker.job;
+    TileJob reply;
+    pixels_.resize(job.pixel_count());
+    if (!worker.connection.receive_all(&reply, sizeof(reply)) ||
+        std::memcmp(&reply, &job, sizeof(job)) != 0 ||
+        !worker.connection.receive_all(pixels_.data(),
+                                       pixels_.size() * sizeof(TilePixel))) {
+      return false;
+    }
+    for (const TilePixel& p : pixels_) {
+      if (p.samples > job.spp) {
+        return false;
+      }
+    }
+
+    const TilePixel* p = pixels_.data();
+    for (int j = job.y0; j < job.y1; ++j) {
+      for (int i = job.x0; i < job.x1; ++i, ++p) {
+        PixelFeatures features;
+        features.albedo = Color(p->albedo[0], p->albedo[1], p->albedo[2]);
+        features.normal = Vec3(p->normal[0], p->normal[1], p->normal[2]);
+        features.depth = p->depth;
+        accumulator.add(i, j, Color(p->color[0], p->color[1], p->color[2]),
+                        p->luminance_squared, features, p->samples);
+      }
+    }
+    return true;
+  }
+
+  void drop(Worker& worker, std::deque<TileJob>& queue, size_t& busy) {
+    if (worker.busy) {
+      queue.push_front(worker.job);
+      worker.busy = false;
+      --busy;
+      std::cerr << "\nLost a worker, its tile goes to another.\n";
+    }
+    worker.connection.close();
+  }
+
+  void remove_dropped() {
+    workers_.erase(std::remove_if(workers_.begin(), workers_.end(),
+                                  [](const Worker& worker) {
+                                    return !worker.connection.valid();
+                                  }),
+                   workers_.end());
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  uint64_t geometry_hash_ = 0;
+  Listener listener_;
+  std::vector<Worker> workers_;
+  std::vector<uint32_t> samples_;
+  std::vector<TilePixel> pixels_;
+};
+
+/// @brief Worker end: renders the tiles a coordinator sends until it
+/// closes the connection.
+class TileWorker {
+ public:
+  /// @brief Connects to the coordinator at address and introduces itself.
+  bool connect(const std::string& address, int width, int height,
+               uint64_t geometry_hash) {
+    width_ = width;
+    height_ = height;
+    connection_ = Connection::connect(address);
+    WorkerHello hello{WorkerHello::kMagic, WorkerHello::kVersion, width,
+                      height, geometry_hash};
+    if (!connection_.valid() ||
+        !connection_.send_all(&hello, sizeof(hello))) {
+      std::cerr << "Cannot connect to " << address << ".\n";
+      return false;
+    }
+    return true;
+  }
+
+  /// @brief Serves tiles, calling render_tile(job, samples, pixels) for
+  /// each. samples holds the sample count of every pixel of the tile before
+  /// the pass, row by row, and render_tile fills pixels in the same order.
+  /// Returns true once the coordinator is done, false on a bad message.
+  template <typename RenderTile>
+  bool serve(RenderTile render_tile) {
+    TileJob job;
+    std::vector<uint32_t> samples;
+    std::vector<TilePixel> pixels;
+    while (connection_.receive_all(&job, sizeof(job))) {
+      if (!job.valid(width_, height_)) {
+        std::cerr << "Bad tile from the coordinator.\n";
+        return false;
+      }
+      samples.resize(job.pixel_count());
+      pixels.assign(job.pixel_count(), TilePixel{});
+      if (!connection_.receive_all(samples.data(),
+                                   samples.size() * sizeof(uint32_t))) {
+        break;
+      }
+      render_tile(job, samples.data(), pixels.data());
+      if (!connection_.send_all(&job, sizeof(job)) ||
+          !connection_.send_all(pixels.data(),
+                                pixels.size() * sizeof(TilePixel))) {
+        break;
+      }
+    }
+    return true;
+  }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  Connection connection_;
+};
+
+#endif  // _RAY_TRACING_LIB_DISTRIBUTED_HPP_
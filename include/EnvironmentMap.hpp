@@ -0,0 +1,168 @@
+#ifndef _RAY_TRACING_LIB_ENVIRONMENT_MAP_HPP_
+#define _RAY_TRACING_LIB_ENVIRONMENT_MAP_HPP_
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Image.hpp"
+#include "color.hpp"
+#include "common.hpp"
+
+/// @brief Light arriving from infinitely far away, stored as an
+/// equirectangular (latitude/longitude) image. A constant background is a
+/// 1x1 map.
+///
+/// Directions are importance sampled through a piecewise-constant 2D
+/// distribution over the texels: a marginal CDF picks the row and that row's
+/// conditional CDF picks the column, so bright texels like the sun are
+/// sampled in proportion to the light they send.
+class EnvironmentMap {
+ public:
+  EnvironmentMap(Color c = Color(0, 0, 0)) : width_(1), height_(1) {
+    texels_.push_back(c);
+    build_distribution();
+  }
+
+  EnvironmentMap(int w, int h, std::vector<Color> texels)
+      : width_(w), height_(h), texels_(std::move(texels)) {
+    build_distribution();
+  }
+
+  /// @brief Loads an HDR image (.hdr, or any format stb_image reads). Falls
+  /// back to a black background if the file can not be read.
+  EnvironmentMap(const std::string& file_name, double intensity = 1.0)
+      : width_(1), height_(1) {
+    int n;
+    float* data = stbi_loadf(file_name.c_str(), &width_, &height_, &n, 3);
+
+    if (!data) {
+      std::cerr << "Cannot load environment map " << file_name
+                << ", using a black background.\n";
+      width_ = height_ = 1;
+      texels_.push_back(Color(0, 0, 0));
+    } else {
+      texels_.resize(static_cast<size_t>(width_) * height_);
+      for (size_t i = 0; i < texels_.size(); ++i) {
+        texels_[i] = intensity *
+                     Color(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+      }
+      stbi_image_free(data);
+    }
+
+    build_distribution();
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  /// @brief False when the map is black and sampling it is wasted work.
+  bool has_distribution() const { return marginal_cdf_.back() > 0; }
+
+  /// @brief Radiance arriving from direction, a single texel fetch.
+  Color lookup(const Vec3& direction) const {
+    return texels_[texel_index(direction)];
+  }
+
+  /// @brief Samples a direction proportionally to the map's radiance. pdf is
+  /// returned with respect to solid angle.
+  Vec3 sample(double u1, double u2, double& pdf) const {
+    int row = sample_cdf(marginal_cdf_.data(), height_, u1);
+    const double* row_cdf = &conditional_cdf_[row * (width_ + 1)];
+    int column = sample_cdf(row_cdf, width_, u2);
+
+    // Place the direction uniformly inside the chosen texel.
+    double u = (column + random_double()) / width_;
+    double v = (row + random_double()) / height_;
+    Vec3 direction = uv_to_direction(u, v);
+
+    pdf = pdf_texel(row, column, v);
+    return direction;
+  }
+
+  /// @brief Solid angle density of sample() producing direction.
+  double pdf(const Vec3& direction) const {
+    double u, v;
+    direction_to_uv(direction, u, v);
+    int column = std::min(static_cast<int>(u * width_), width_ - 1);
+    int row = std::min(static_cast<int>(v * height_), height_ - 1);
+    return pdf_texel(row, column, v);
+  }
+
+ private:
+  int width_;
+  int height_;
+  std::vector<Color> texels_;
+  std::vector<double> conditional_cdf_;  // height_ rows of width_ + 1
+  std::vector<double> marginal_cdf_;     // height_ + 1 entries
+  std::vector<double> weights_;          // unnormalized texel weights
+
+  // u follows the azimuth, v goes from +y (v = 0) down to -y (v = 1).
+  static void direction_to_uv(const Vec3& d, double& u, double& v) {
+    Vec3 unit = unit_vector(d);
+    u = 0.5 + std::atan2(unit.x(), -unit.z()) / (2 * pi);
+    v = std::acos(clamp(unit.y(), -1.0, 1.0)) / pi;
+  }
+
+  static Vec3 uv_to_direction(double u, double v) {
+    double phi = (u - 0.5) * 2 * pi;
+    double theta = v * pi;
+    double sin_theta = std::sin(theta);
+    return Vec3(sin_theta * std::sin(phi), std::cos(theta),
+                -sin_theta * std::cos(phi));
+  }
+
+  size_t texel_index(const Vec3& direction) const {
+    double u, v;
+    direction_to_uv(direction, u, v);
+    int column = std::min(static_cast<int>(u * width_), width_ - 1);
+    int row = std::min(static_cast<int>(v * height_), height_ - 1);
+    return static_cast<size_t>(row) * width_ + column;
+  }
+
+  void build_distribution() {
+    weights_.resize(texels_.size());
+    conditional_cdf_.assign(static_cast<size_t>(height_) * (width_ + 1), 0.0);
+    marginal_cdf_.assign(height_ + 1, 0.0);
+
+    for (int row = 0; row < height_; ++row) {
+      // Rows near the poles cover less solid angle.
+      double sin_theta = std::sin(pi * (row + 0.5) / height_);
+      double* cdf = &conditional_cdf_[row * (width_ + 1)];
+      for (int column = 0; column < width_; ++column) {
+        size_t i = static_cast<size_t>(row) * width_ + column;
+        weights_[i] = fmax(0.0, luminance(texels_[i])) * sin_theta;
+        cdf[column + 1] = cdf[column] + weights_[i];
+      }
+      marginal_cdf_[row + 1] = marginal_cdf_[row] + cdf[width_];
+    }
+  }
+
+  // Finds the bucket of an unnormalized CDF containing u in [0,1).
+  static int sample_cdf(const double* cdf, int n, double u) {
+    double target = u * cdf[n];
+    const double* it = std::upper_bound(cdf + 1, cdf + n + 1, target);
+    int index = std::min(static_cast<int>(it - cdf) - 1, n - 1);
+    // Skip zero-weight buckets that clamping at the end may land on.
+    while (index > 0 && cdf[index + 1] == cdf[index]) {
+      --index;
+    }
+    return index;
+  }
+
+  double pdf_texel(int row, int column, double v) const {
+    double total = marginal_cdf_.back();
+    double sin_theta = std::sin(pi * v);
+    if (total <= 0 || sin_theta <= 0) {
+      return 0.0;
+    }
+
+    // Density over the unit [u,v] square, then converted to solid angle.
+    double weight = weights_[static_cast<size_t>(row) * width_ + column];
+    double pdf_uv = weight * width_ * height_ / total;
+    return pdf_uv / (2 * pi * pi * sin_theta);
+  }
+};
+
+#endif  // _RAY_TRACING_LIB_ENVIRONMENT_MAP_HPP_
@@ -0,0 +1,562 @@
+#ifndef _RAY_TRACING_LIB_FLAT_SCENE_HPP_
+#define _RAY_TRACING_LIB_FLAT_SCENE_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Hittable.hpp"
+#include "HittableList.hpp"
+#include "LinearBvh.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "SphereStore.hpp"
+#include "Texture.hpp"
+#include "common.hpp"
+
+/// @brief Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const std::string& file_name) {
+    close();
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const unsigned char*>(data);
+        size_ = info.st_size;
+      }
+    }
+    ::close(fd);
+    return data_ != nullptr;
+  }
+
+  void close() {
+    if (data_) {
+      ::munmap(const_cast<unsigned char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  void swap(MappedFile& other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+  }
+
+  const unsigned char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const unsigned char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+/// @brief Plain description of a material and its texture.
+struct FlatMaterial {
+  enum Type : uint32_t { kLambertian, kMetal, kDielectric, kLight };
+  enum Texture : uint32_t { kSolid, kChecker };
+
+  uint32_t type;
+  uint32_t texture;
+  double color[3];     // solid color, or the even checker color
+  double odd[3];       // odd checker color
+  double parameter;    // fuzz or index of refraction
+};
+
+/// @brief Spheres, materials and a LinearBvh stored as flat arrays with no
+/// pointers, so the whole scene can be written to a file and later
+/// memory-mapped and traversed in place.
+///
+/// The spheres are PackedSphere records in BVH leaf order, with their
+/// material indices in a parallel array that is only read for the closest
+/// hit. The cache file is a header followed by the sphere, sphere material,
+/// node and material arrays, each at a 64-byte aligned offset. The header
+/// records the geometry hash of the scene file it was built from, so a
+/// cache is only used while the spheres and materials it holds are
+/// unchanged.
+class FlatScene : public Hittable {
+ public:
+  /// @brief Builds from the spheres in store.
+  void build(const SphereStore& store) {
+    // Leaves of up to four spheres take a third of the nodes that SAH
+    // leaves take, which matters next to 16-byte spheres, and a leaf's
+    // spheres share one or two cache lines.
+    LinearBvh bvh;
+    bvh.sah_leaves = false;
+    bvh.build(store.size(), [&](size_t i) { return store.bounds(i); });
+
+    // Store the spheres in leaf order so every leaf is a contiguous range.
+    owned_spheres_.resize(store.size());
+    owned_sphere_materials_.resize(store.size());
+    for (size_t i = 0; i < store.size(); ++i) {
+      owned_spheres_[i] = store.spheres[bvh.order[i]];
+      owned_sphere_materials_[i] = store.material_of[bvh.order[i]];
+    }
+    owned_nodes_ = std::move(bvh.nodes);
+
+    // Materials without a flat form, such as image textures, are rendered
+    // as they are but keep the scene out of the cache.
+    flat_ = true;
+    owned_materials_.assign(store.materials.size(), FlatMaterial{});
+    for (size_t i = 0; i < store.materials.size(); ++i) {
+      flat_ &= flatten(store.materials[i], owned_materials_[i]);
+    }
+    mapping_.close();
+
+    attach(owned_spheres_.data(), owned_sphere_materials_.data(),
+           owned_spheres_.size(), owned_nodes_.data(), owned_nodes_.size(),
+           owned_materials_.data(), owned_materials_.size());
+    material_objects_ = store.materials;
+  }
+
+  /// @brief Writes the scene to file_name, tagged with geometry_hash.
+  /// Returns false without writing if a material has no flat form.
+  bool save(const std::string& file_name, uint64_t geometry_hash) const {
+    if (!flat_) {
+      return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.version = kVersion;
+    header.header_size = sizeof(Header);
+    header.geometry_hash = geometry_hash;
+    header.sphere_count = sphere_count_;
+    header.node_count = node_count_;
+    header.material_count = material_count_;
+    header.sphere_offset = align(sizeof(Header));
+    header.sphere_material_offset =
+        align(header.sphere_offset + sphere_count_ * sizeof(PackedSphere));
+    header.node_offset = align(header.sphere_material_offset +
+                               sphere_count_ * sizeof(uint32_t));
+    header.material_offset =
+        align(header.node_offset + node_count_ * sizeof(LinearBvhNode));
+    header.file_size =
+        header.material_offset + material_count_ * sizeof(FlatMaterial);
+
+    std::string temporary = file_name + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file) {
+        std::cerr << "Cannot write scene cache " << temporary << ".\n";
+        return false;
+      }
+      auto section = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char zeros[kAlignment] = {};
+        file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+        file.write(static_cast<const char*>(data), bytes);
+      };
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      section(header.sphere_offset, spheres_,
+              sphere_count_ * sizeof(PackedSphere));
+      section(header.sphere_material_offset, sphere_materials_,
+              sphere_count_ * sizeof(uint32_t));
+      section(header.node_offset, nodes_, node_count_ * sizeof(LinearBvhNode));
+      section(header.material_offset, materials_,
+              material_count_ * sizeof(FlatMaterial));
+      if (!file) {
+        std::cerr << "Failed writing scene cache " << temporary << ".\n";
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), file_name.c_str()) == 0;
+  }
+
+  /// @brief Maps a cache written by save(). Returns false if it is missing,
+  /// from another version, for other geometry or inconsistent.
+  bool open(const std::string& file_name, uint64_t geometry_hash) {
+    MappedFile mapping;
+    if (!mapping.open(file_name) || mapping.size() < sizeof(Header)) {
+      return false;
+    }
+
+    Header header;
+    std::memcpy(&header, mapping.data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(header.magic)) != 0 ||
+        header.version != kVersion || header.header_size != sizeof(Header) ||
+        header.geometry_hash != geometry_hash ||
+        header.file_size != mapping.size() ||
+        !section_fits(header.sphere_offset, header.sphere_count,
+                      sizeof(PackedSphere), mapping.size()) ||
+        !section_fits(header.sphere_material_offset, header.sphere_count,
+                      sizeof(uint32_t), mapping.size()) ||
+        !section_fits(header.node_offset, header.node_count,
+                      sizeof(LinearBvhNode), mapping.size()) ||
+        !section_fits(header.material_offset, header.material_count,
+                      sizeof(FlatMaterial), mapping.size())) {
+      return false;
+    }
+
+    const unsigned char* base = mapping.data();
+    auto spheres =
+        reinterpret_cast<const PackedSphere*>(base + header.sphere_offset);
+    auto sphere_materials = reinterpret_cast<const uint32_t*>(
+        base + header.sphere_material_offset);
+    auto nodes =
+        reinterpret_cast<const LinearBvhNode*>(base + header.node_offset);
+    auto materials =
+        reinterpret_cast<const FlatMaterial*>(base + header.material_offset);
+    if (!consistent(sphere_materials, header.sphere_count, nodes,
+                    header.node_count, materials, header.material_count)) {
+      std::cerr << "Scene cache " << file_name << " is corrupt.\n";
+      return false;
+    }
+
+    owned_spheres_.clear();
+    owned_sphere_materials_.clear();
+    owned_nodes_.clear();
+    owned_materials_.clear();
+    mapping_.swap(mapping);
+    attach(spheres, sphere_materials, header.sphere_count, nodes,
+           header.node_count, materials, header.material_count);
+
+    // The material table is small; HitRecord needs real Material objects.
+    material_objects_.clear();
+    for (size_t i = 0; i < material_count_; ++i) {
+      material_objects_.push_back(unflatten(materials_[i]));
+    }
+    flat_ = true;
+    return true;
+  }
+
+  virtual bool hit(const Ray& r, double t_min, double t_max,
+                   HitRecord& rec) const override {
+    const uint32_t root = 0;
+    return hit(&root, node_count_ > 0 ? 1 : 0, r, t_min, t_max, rec);
+  }
+
+  /// @brief Like hit(), for a ray of the tile entries were culled for.
+  bool hit(const std::vector<uint32_t>& entries, const Ray& r, double t_min,
+           double t_max, HitRecord& rec) const {
+    return hit(entries.data(), entries.size(), r, t_min, t_max, rec);
+  }
+
+  /// @brief The BVH nodes the camera rays of frustum's tile start at.
+  void cull(const Frustum& frustum, std::vector<uint32_t>& entries) const {
+    LinearBvh::cull(nodes_, node_count_, frustum, entries);
+  }
+
+  /// @brief Intersects r with sphere number index, in BVH leaf order as in
+  /// HitRecord::primitive, alone. Gives the same record as hit() for a ray
+  /// whose closest hit is that sphere.
+  bool hit_sphere(uint32_t index, const Ray& r, double t_min, double t_max,
+                  HitRecord& rec) const {
+    TRACE_STAT(sphere_tests++);
+    double t;
+    if (index >= sphere_count_ ||
+        !intersect(spheres_[index], r, r.direction().length_squared(), t_min,
+                   t_max, t)) {
+      return false;
+    }
+    TRACE_STAT(sphere_hits++);
+    record(index, r, t, rec);
+    return true;
+  }
+
+  /// @brief Hash of the spheres' positions and radii in BVH leaf order,
+  /// which changes with the geometry but not with the materials.
+  uint64_t shape_hash() const {
+    uint64_t hash = mix_seed(sphere_count_, 0);
+    for (size_t i = 0; i < sphere_count_; ++i) {
+      uint64_t words[2];
+      std::memcpy(words, &spheres_[i], sizeof(words));
+      hash = mix_seed(hash ^ words[0], words[1]);
+    }
+    return hash;
+  }
+
+  virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override {
+    if (node_count_ == 0) {
+      return false;
+    }
+    const LinearBvhNode& root = nodes_[0];
+    output_box =
+        AxisAlignedBoundingBox(Point3(root.min[0], root.min[1], root.min[2]),
+                               Point3(root.max[0], root.max[1], root.max[2]));
+    return true;
+  }
+
+  /// @brief The emissive spheres as separate objects, for light sampling.
+  HittableList lights() const {
+    HittableList lights;
+    for (size_t i = 0; i < sphere_count_; ++i) {
+      const PackedSphere& s = spheres_[i];
+      const auto& material = material_objects_[sphere_materials_[i]];
+      Point3 center(s.center[0], s.center[1], s.center[2]);
+      if (!material->emitted(0.5, 0.5, center).near_zero()) {
+        lights.add(make_shared<Sphere>(center, s.radius, material));
+      }
+    }
+    return lights;
+  }
+
+  size_t sphere_count() const { return sphere_count_; }
+  size_t node_count() const { return node_count_; }
+  size_t material_count() const { return material_count_; }
+  bool mapped() const { return mapping_.data() != nullptr; }
+
+ private:
+  static constexpr char kMagic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', 0};
+  static constexpr uint32_t kVersion = 2;
+  static constexpr size_t kAlignment = 64;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t geometry_hash;
+    uint64_t sphere_count;
+    uint64_t node_count;
+    uint64_t material_count;
+    uint64_t sphere_offset;
+    uint64_t sphere_material_offset;
+    uint64_t node_offset;
+    uint64_t material_offset;
+    uint64_t file_size;
+  };
+
+  static uint64_t align(uint64_t offset) {
+    return (offset + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  static bool section_fits(uint64_t offset, uint64_t count, size_t size,
+                           size_t file_size) {
+    return offset % kAlignment == 0 && offset <= file_size &&
+           count <= (file_size - offset) / size;
+  }
+
+  // Checks every index, and that no path down the tree is deeper than the
+  // traversal stack of LinearBvh::max_depth allows, so a damaged file can
+  // not send traversal out of bounds.
+  static bool consistent(const uint32_t* sphere_materials,
+                         uint64_t sphere_count, const LinearBvhNode* nodes,
+                         uint64_t node_count, const FlatMaterial* materials,
+                         uint64_t material_count) {
+    for (uint64_t i = 0; i < sphere_count; ++i) {
+      if (sphere_materials[i] >= material_count) {
+        return false;
+      }
+    }
+    // Children come after their parent, so one pass in order sees every
+    // node's depth before its children need it.
+    std::vector<uint8_t> depth(node_count, 0);
+    for (uint64_t i = 0; i < node_count; ++i) {
+      const LinearBvhNode& node = nodes[i];
+      bool ok = node.leaf()
+                    ? uint64_t(node.offset) + node.count <= sphere_count
+                    : node.offset > i + 1 && node.offset < node_count &&
+                          i + 1 < node_count && node.axis < 3 &&
+                          depth[i] < LinearBvh::max_depth;
+      if (!ok) {
+        return false;
+      }
+      if (!node.leaf()) {
+        uint8_t below = depth[i] + 1;
+        depth[i + 1] = std::max(depth[i + 1], below);
+        depth[node.offset] = std::max(depth[node.offset], below);
+      }
+    }
+    for (uint64_t i = 0; i < material_count; ++i) {
+      if (materials[i].type > FlatMaterial::kLight ||
+          materials[i].texture > FlatMaterial::kChecker) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Closest hit below the given BVH nodes.
+  bool hit(const uint32_t* entries, size_t entry_count, const Ray& r,
+           double t_min, double t_max, HitRecord& rec) const {
+    const PackedSphere* spheres = spheres_;
+    const double a = r.direction().length_squared();
+    uint32_t closest = UINT32_MAX;
+    [[maybe_unused]] uint64_t tested = 0;
+    [[maybe_unused]] uint64_t hits = 0;
+
+    LinearBvh::traverse(
+        nodes_, entries, entry_count, r, t_min, t_max,
+        [&](uint32_t first, uint32_t count, double& t_max) {
+          bool found = false;
+          tested += count;
+          for (uint32_t k = first; k < first + count; ++k) {
+            double t;
+            if (intersect(spheres[k], r, a, t_min, t_max, t)) {
+              t_max = t;
+              closest = k;
+              found = true;
+              ++hits;
+            }
+          }
+          return found;
+        });
+    TRACE_STAT(sphere_tests += tested);
+    TRACE_STAT(sphere_hits += hits);
+
+    if (closest == UINT32_MAX) {
+      return false;
+    }
+    record(closest, r, t_max, rec);
+    return true;
+  }
+
+  void record(uint32_t index, const Ray& r, double t, HitRecord& rec) const {
+    const PackedSphere& s = spheres_[index];
+    Point3 center(s.center[0], s.center[1], s.center[2]);
+    rec.t = t;
+    rec.p = r.at(rec.t);
+    Vec3 outward_normal = (rec.p - center) / s.radius;
+    rec.set_face_normal(r, outward_normal);
+    Sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.footprint = r.width_at(rec.t) / (pi * s.radius);
+    rec.mat_ptr = material_objects_[sphere_materials_[index]];
+    rec.primitive = index;
+    rec.sampled_light = true;
+  }
+
+  // In double precision, like Sphere::hit, from the float record.
+  static bool intersect(const PackedSphere& s, const Ray& r, double a,
+                        double t_min, double t_max, double& t) {
+    Vec3 oc = r.origin() - Point3(s.center[0], s.center[1], s.center[2]);
+    double half_b = dot(oc, r.direction());
+    double radius = s.radius;
+    double c = oc.length_squared() - radius * radius;
+    double discriminant = half_b * half_b - a * c;
+    if (discriminant < 0) {
+      return false;
+    }
+    double sqrtd = sqrt(discriminant);
+
+    t = (-half_b - sqrtd) / a;
+    if (t < t_min || t_max < t) {
+      t = (-half_b + sqrtd) / a;
+      if (t < t_min || t_max < t) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool flatten_texture(const shared_ptr<Texture>& texture,
+                              FlatMaterial& out) {
+    auto store = [](const Color& c, double* out) {
+      out[0] = c.x();
+      out[1] = c.y();
+      out[2] = c.z();
+    };
+
+    if (std::dynamic_pointer_cast<SolidColor>(texture)) {
+      out.texture = FlatMaterial::kSolid;
+      store(texture->value(0, 0, Point3()), out.color);
+      return true;
+    }
+    auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture);
+    if (checker && std::dynamic_pointer_cast<SolidColor>(checker->even) &&
+        std::dynamic_pointer_cast<SolidColor>(checker->odd)) {
+      out.texture = FlatMaterial::kChecker;
+      store(checker->even->value(0, 0, Point3()), out.color);
+      store(checker->odd->value(0, 0, Point3()), out.odd);
+      return true;
+    }
+    return false;
+  }
+
+  static bool flatten(const shared_ptr<Material>& material, FlatMaterial& out) {
+    out = FlatMaterial{};
+    if (auto lambertian = std::dynamic_pointer_cast<Lambertian>(material)) {
+      out.type = FlatMaterial::kLambertian;
+      return flatten_texture(lambertian->albedo, out);
+    }
+    if (auto metal = std::dynamic_pointer_cast<Metal>(material)) {
+      out.type = FlatMaterial::kMetal;
+      out.texture = FlatMaterial::kSolid;
+      for (int a = 0; a < 3; ++a) {
+        out.color[a] = metal->albedo[a];
+      }
+      out.parameter = metal->fuzz;
+      return true;
+    }
+    if (auto dielectric = std::dynamic_pointer_cast<Dielectric>(material)) {
+      out.type = FlatMaterial::kDielectric;
+      out.texture = FlatMaterial::kSolid;
+      out.parameter = dielectric->refraction_index;
+      return true;
+    }
+    if (auto light = std::dynamic_pointer_cast<DiffuseLight>(material)) {
+      out.type = FlatMaterial::kLight;
+      return flatten_texture(light->emit, out) &&
+             out.texture == FlatMaterial::kSolid;
+    }
+    return false;
+  }
+
+  static shared_ptr<Material> unflatten(const FlatMaterial& m) {
+    Color color(m.color[0], m.color[1], m.color[2]);
+    switch (m.type) {
+      case FlatMaterial::kLambertian:
+        if (m.texture == FlatMaterial::kChecker) {
+          return make_shared<Lambertian>(make_shared<CheckerTexture>(
+              color, Color(m.odd[0], m.odd[1], m.odd[2])));
+        }
+        return make_shared<Lambertian>(color);
+      case FlatMaterial::kMetal:
+        return make_shared<Metal>(color, m.parameter);
+      case FlatMaterial::kDielectric:
+        return make_shared<Dielectric>(m.parameter);
+      default:
+        return make_shared<DiffuseLight>(color);
+    }
+  }
+
+  void attach(const PackedSphere* spheres, const uint32_t* sphere_materials,
+              size_t sphere_count, const LinearBvhNode* nodes,
+              size_t node_count, const FlatMaterial* materials,
+              size_t material_count) {
+    spheres_ = spheres;
+    sphere_materials_ = sphere_materials;
+    sphere_count_ = sphere_count;
+    nodes_ = nodes;
+    node_count_ = node_count;
+    materials_ = materials;
+    material_count_ = material_count;
+  }
+
+  const PackedSphere* spheres_ = nullptr;
+  const uint32_t* sphere_materials_ = nullptr;
+  size_t sphere_count_ = 0;
+  const LinearBvhNode* nodes_ = nullptr;
+  size_t node_count_ = 0;
+  const FlatMaterial* materials_ = nullptr;
+  size_t material_count_ = 0;
+  std::vector<shared_ptr<Material>> material_objects_;
+  bool flat_ = true;  // every material has a flat form
+
+  // Backing storage: either built in memory or a mapped cache file.
+  std::vector<PackedSphere> owned_spheres_;
+  std::vector<uint32_t> owned_sphere_materials_;
+  std::vector<LinearBvhNode> owned_nodes_;
+  std::vector<FlatMaterial> owned_materials_;
+  MappedFile mapping_;
+};
+
+#endif  // _RAY_TRACING_LIB_FLAT_SCENE_HPP_
@@ -0,0 +1,118 @@
+#ifndef _RAY_TRACING_LIB_FRAME_QUEUE_HPP_
+#define _RAY_TRACING_LIB_FRAME_QUEUE_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Image.hpp"
+#include "Vec3.hpp"
+
+/// @brief Pipelines image output with rendering. Frames are rendered into
+/// framebuffers taken from a fixed pool, handed to a background thread that
+/// encodes and writes them, and returned to the pool afterwards. At most
+/// max_in_flight frames exist at once, so memory stays bounded and buffers
+/// are reused from frame to frame.
+class FrameQueue {
+ public:
+  using Writer = std::function<void(const std::vector<Color>&)>;
+
+  FrameQueue(size_t pixel_count, size_t max_in_flight = 2) {
+    for (size_t i = 0; i < std::max<size_t>(1, max_in_flight); ++i) {
+      buffers_.push_back(std::make_unique<std::vector<Color>>(pixel_count));
+      free_.push_back(buffers_.back().get());
+    }
+    writer_ = std::thread([this]() { run(); });
+  }
+
+  FrameQueue(const FrameQueue&) = delete;
+  FrameQueue& operator=(const FrameQueue&) = delete;
+
+  ~FrameQueue() { finish(); }
+
+  /// @brief Returns a framebuffer to render into, blocking while every
+  /// buffer is still waiting to be written.
+  std::vector<Color>& acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    buffer_free_.wait(lock, [this]() { return !free_.empty(); });
+    std::vector<Color>* frame = free_.front();
+    free_.pop_front();
+    return *frame;
+  }
+
+  /// @brief Queues a rendered framebuffer from acquire() to be written by
+  /// write on the background thread. The caller must not touch it again.
+  void submit(std::vector<Color>& frame, Writer write) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back({&frame, std::move(write)});
+    }
+    job_ready_.notify_one();
+  }
+
+  /// @brief Queues frame to be written as file_name through image.
+  void submit(std::vector<Color>& frame, shared_ptr<Image> image,
+              std::string file_name) {
+    submit(frame, [image, file_name](const std::vector<Color>& pixels) {
+      image->write(file_name, pixels);
+    });
+  }
+
+  /// @brief Waits until every queued frame has been written.
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) {
+        return;
+      }
+      stopping_ = true;
+    }
+    job_ready_.notify_one();
+    writer_.join();
+  }
+
+ private:
+  struct Job {
+    std::vector<Color>* frame;
+    Writer write;
+  };
+
+  void run() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_ready_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+
+      job.write(*job.frame);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(job.frame);
+      }
+      buffer_free_.notify_one();
+    }
+  }
+
+  std::vector<std::unique_ptr<std::vector<Color>>> buffers_;
+  std::deque<std::vector<Color>*> free_;
+  std::deque<Job> jobs_;
+  std::mutex mutex_;
+  std::condition_variable job_ready_;
+  std::condition_variable buffer_free_;
+  bool stopping_ = false;
+  std::thread writer_;
+};
+
+#endif  // _RAY_TRACING_LIB_FRAME_QUEUE_HPP_
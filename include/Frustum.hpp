@@ -0,0 +1,64 @@
+#ifndef _RAY_TRACING_LIB_FRUSTUM_HPP_
+#define _RAY_TRACING_LIB_FRUSTUM_HPP_
+
+#include <cmath>
+
+#include "common.hpp"
+
+/// @brief The region the camera rays of an image tile can reach, for
+/// discarding boxes that no such ray enters.
+///
+/// With a lens the rays of a tile start anywhere on the lens disk and meet
+/// in the tile's rectangle on the focus plane, so the region narrows up to
+/// that plane and widens again behind it. Each side of the rectangle
+/// therefore bounds the region with two planes, one through either rim of
+/// the lens, and only a box beyond both lies outside. A pinhole camera
+/// gives the usual four planes twice.
+struct Frustum {
+  /// @brief Points x with dot(normal, x) <= offset are inside.
+  struct Plane {
+    Vec3 normal;
+    double offset = 0;
+
+    /// @brief True if the whole box lies beyond the plane, with a margin
+    /// for rounding.
+    bool excludes(const float min[3], const float max[3]) const {
+      double nearest = 0;
+      for (int a = 0; a < 3; ++a) {
+        nearest += normal[a] * (normal[a] > 0 ? min[a] : max[a]);
+      }
+      return nearest > offset + 1e-6 * (1 + std::abs(offset));
+    }
+  };
+
+  Plane sides[4][2];
+  Plane near;  // the lens plane, which rays only leave forwards
+  Vec3 direction;  // of the ray through the middle of the tile
+
+  bool excludes(const float min[3], const float max[3]) const {
+    if (near.excludes(min, max)) {
+      return true;
+    }
+    for (const auto& side : sides) {
+      if (side[0].excludes(min, max) && side[1].excludes(min, max)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Plane through the line at point with direction and through
+  /// lens_point, facing away from inside.
+  static Plane side(const Point3& point, const Vec3& direction,
+                    const Point3& lens_point, const Point3& inside) {
+    Plane plane;
+    plane.normal = unit_vector(cross(direction, point - lens_point));
+    if (dot(plane.normal, inside - point) > 0) {
+      plane.normal = -plane.normal;
+    }
+    plane.offset = dot(plane.normal, point);
+    return plane;
+  }
+};
+
+#endif  // _RAY_TRACING_LIB_FRUSTUM_HPP_
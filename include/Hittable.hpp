@@ -1,6 +1,8 @@
 #ifndef HITTABLE_HPP
 #define HITTABLE_HPP
 
+#include <cstdint>
+
 #include "AxisAlignedBoundingBox.hpp"
 #include "Ray.hpp"
 #include "common.hpp"
@@ -8,12 +10,20 @@
 class Material;
 
 struct HitRecord {
+  static constexpr uint32_t kNoPrimitive = UINT32_MAX;
+
   Point3 p;
   Vec3 normal;
   shared_ptr<Material> mat_ptr;
   double t;
   double u;
   double v;
+  double footprint = 0;  // width of the ray's cone in (u, v) units
+  // Index of the hit sphere of a FlatScene, kNoPrimitive for other objects.
+  uint32_t primitive = kNoPrimitive;
+  // Whether the hit object is in the scene's LightTree if it emits, so next
+  // event estimation already samples its light. Only static spheres are.
+  bool sampled_light = false;
   bool front_face;
 
   /**
@@ -31,6 +41,27 @@ class Hittable {
   virtual bool hit(const Ray& r, double t_min, double t_max,
                    HitRecord& rec) const = 0;
   virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const = 0;
+
+  /// @brief Bounds of the object while time runs from time0 to time1. Only
+  /// moving objects need to override this; bounding_box() covers all time.
+  virtual bool motion_bounds(double time0, double time1,
+                             AxisAlignedBoundingBox& output_box) const {
+    return bounding_box(output_box);
+  }
+
+  // Light sampling interface. Only emissive primitives that are handed to a
+  // LightTree need to override these.
+
+  /// @brief Solid angle density of random(origin) generating direction.
+  virtual double pdf_value(const Point3& origin, const Vec3& direction) const {
+    return 0.0;
+  }
+
+  /// @brief Returns a direction from origin towards a point on the object.
+  virtual Vec3 random(const Point3& origin) const { return Vec3(1, 0, 0); }
+
+  /// @brief Total emitted power, used to weight the object as a light.
+  virtual double emitted_power() const { return 0.0; }
 };
 
 #endif
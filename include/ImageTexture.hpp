@@ -0,0 +1,66 @@
+#ifndef _RAY_TRACING_LIB_IMAGE_TEXTURE_HPP_
+#define _RAY_TRACING_LIB_IMAGE_TEXTURE_HPP_
+
+#include <cmath>
+#include <string>
+
+#include "Texture.hpp"
+#include "TextureCache.hpp"
+#include "common.hpp"
+
+/// @brief Texture read from an image file through a TextureCache. (u, v)
+/// wraps around, with v = 0 at the bottom of the image.
+///
+/// Lookups are bilinear within one mip level, picked so its texels are about
+/// as wide as the ray's footprint. The level is chosen at random between the
+/// two nearest ones, weighted so the average over many samples is trilinear
+/// filtering at the cost of a single bilinear lookup.
+class ImageTexture : public Texture {
+ public:
+  ImageTexture(const std::string& file_name,
+               TextureCache& cache = TextureCache::shared())
+      : cache_(cache), id_(cache.open(file_name)) {}
+
+  /// @brief False if the image could not be read.
+  bool valid() const { return id_ >= 0; }
+
+  virtual Color value(double u, double v, const Point3& p) const override {
+    return filtered_value(u, v, p, 0.0);
+  }
+
+  virtual Color filtered_value(double u, double v, const Point3& p,
+                               double footprint) const override {
+    if (id_ < 0) {
+      return Color(0, 0, 0);
+    }
+
+    int level = 0;
+    int levels = cache_.levels(id_);
+    double size = std::max(cache_.width(id_, 0), cache_.height(id_, 0));
+    double lod = footprint > 0 ? std::log2(footprint * size) : 0.0;
+    if (lod > 0) {
+      level = std::min(levels - 1,
+                       static_cast<int>(std::floor(lod + random_double())));
+    }
+
+    double x = u * cache_.width(id_, level) - 0.5;
+    double y = (1 - v) * cache_.height(id_, level) - 0.5;
+    double x0 = std::floor(x);
+    double y0 = std::floor(y);
+    double fx = x - x0;
+    double fy = y - y0;
+    int i = static_cast<int>(x0);
+    int j = static_cast<int>(y0);
+
+    return (1 - fy) * ((1 - fx) * cache_.texel(id_, level, i, j) +
+                       fx * cache_.texel(id_, level, i + 1, j)) +
+           fy * ((1 - fx) * cache_.texel(id_, level, i, j + 1) +
+                 fx * cache_.texel(id_, level, i + 1, j + 1));
+  }
+
+ private:
+  TextureCache& cache_;
+  int id_;
+};
+
+#endif  // _RAY_TRACING_LIB_IMAGE_TEXTURE_HPP_
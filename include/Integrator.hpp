@@ -0,0 +1,333 @@
+#ifndef _RAY_TRACING_LIB_INTEGRATOR_HPP_
+#define _RAY_TRACING_LIB_INTEGRATOR_HPP_
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Accumulator.hpp"
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "EnvironmentMap.hpp"
+#include "Hittable.hpp"
+#include "LightTree.hpp"
+#include "Material.hpp"
+#include "PathGuide.hpp"
+#include "PrimaryHitCache.hpp"
+#include "Ray.hpp"
+#include "TraceStats.hpp"
+#include "color.hpp"
+#include "common.hpp"
+
+// The path tracer: the radiance along a ray and the samples of a pixel,
+// shared by every way of running a render.
+
+// Everything ray_color needs to know about the scene besides the ray itself.
+struct RenderContext {
+  const Hittable& world;
+  const EnvironmentMap& background;
+  const LightTree& lights;
+  PathGuide* guide = nullptr;  // learned scattering for diffuse bounces
+  // Ray cone spread of camera rays, about one pixel, and the spread a
+  // diffuse bounce adds, so deeper paths read coarser texture mip levels.
+  double pixel_spread = 0;
+  double diffuse_spread = 0;
+  // Camera ray hits kept from an earlier render of the same view, if any.
+  PrimaryHitCache* primary_hits = nullptr;
+  // What camera rays are traced against instead of world, such as a
+  // TileWorld of the tile being rendered.
+  const Hittable* camera_world = nullptr;
+};
+
+// Continues the cone of r from its footprint at rec into scattered.
+inline void continue_cone(const Ray& r, const HitRecord& rec,
+                          double added_spread, Ray& scattered) {
+  scattered.width = r.width_at(rec.t);
+  scattered.spread = r.spread + added_spread;
+}
+
+// Next event estimation: picks one light from the light tree and connects the
+// hit point to it with a shadow ray sent at time.
+inline Color sample_direct_light(const HitRecord& rec, double time,
+                                 const RenderContext& context) {
+  double pmf;
+  auto light = context.lights.sample(rec.p, rec.normal, random_double(), pmf);
+  if (!light) {
+    return Color(0, 0, 0);
+  }
+
+  Vec3 direction = unit_vector(light->random(rec.p));
+  double pdf = light->pdf_value(rec.p, direction);
+  if (pdf <= 0) {
+    return Color(0, 0, 0);
+  }
+
+  Ray shadow_ray(rec.p, direction, time);
+  HitRecord light_rec;
+  if (!light->hit(shadow_ray, 0.001, infinity, light_rec)) {
+    return Color(0, 0, 0);
+  }
+
+  TRACE_STAT(rays[TraceCounters::kShadowRay]++);
+  HitRecord occluder;
+  if (context.world.hit(shadow_ray, 0.001, light_rec.t - 0.001, occluder)) {
+    return Color(0, 0, 0);
+  }
+
+  Color emitted =
+      light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+  return emitted * rec.mat_ptr->eval(rec, direction) / (pdf * pmf);
+}
+
+// Power heuristic weight for a sample drawn with pdf_a that could also have
+// been drawn with pdf_b.
+inline double power_heuristic(double pdf_a, double pdf_b) {
+  double a2 = pdf_a * pdf_a;
+  double b2 = pdf_b * pdf_b;
+  return (a2 + b2) > 0 ? a2 / (a2 + b2) : 0.0;
+}
+
+// Density of choose_diffuse_direction() picking direction: the BRDF pdf,
+// mixed with the learned guiding distribution when one exists at rec.p.
+inline double diffuse_pdf(const HitRecord& rec, const Vec3& direction,
+                          const RenderContext& context) {
+  double pdf = rec.mat_ptr->scattering_pdf(rec, direction);
+  if (!context.guide) {
+    return pdf;
+  }
+
+  auto distribution = context.guide->distribution(rec.p);
+  if (!distribution) {
+    return pdf;
+  }
+
+  double alpha = context.guide->sampling_fraction;
+  return alpha * distribution->pdf(direction) + (1 - alpha) * pdf;
+}
+
+// Samples the environment map towards its bright regions and weights the
+// result against the BRDF sampling of the next bounce.
+inline Color sample_environment(const HitRecord& rec, double time,
+                                const RenderContext& context) {
+  const EnvironmentMap& background = context.background;
+  if (!background.has_distribution()) {
+    return Color(0, 0, 0);
+  }
+
+  double pdf;
+  Vec3 direction = background.sample(random_double(), random_double(), pdf);
+  if (pdf <= 0) {
+    return Color(0, 0, 0);
+  }
+
+  Color f = rec.mat_ptr->eval(rec, direction);
+  if (f.near_zero()) {
+    return Color(0, 0, 0);
+  }
+
+  TRACE_STAT(rays[TraceCounters::kEnvironmentRay]++);
+  HitRecord occluder;
+  if (context.world.hit(Ray(rec.p, direction, time), 0.001, infinity,
+                        occluder)) {
+    return Color(0, 0, 0);
+  }
+
+  double weight = power_heuristic(pdf, diffuse_pdf(rec, direction, context));
+  return weight * f * background.lookup(direction) / pdf;
+}
+
+// Picks the next direction at a diffuse hit. Without a guide this is the
+// material's own scatter(); with one, a fraction of the samples follow the
+// learned incident radiance instead. Returns the pdf of the choice.
+inline double choose_diffuse_direction(const Ray& r, const HitRecord& rec,
+                                       const RenderContext& context,
+                                       Color& attenuation, Ray& scattered) {
+  const DirectionalDistribution* distribution =
+      context.guide ? context.guide->distribution(rec.p) : nullptr;
+
+  if (distribution && random_double() < context.guide->sampling_fraction) {
+    double guide_pdf;
+    Vec3 direction = distribution->sample(random_double(), random_double(),
+                                          random_double(), guide_pdf);
+    scattered = Ray(rec.p, direction, r.time());
+    TRACE_STAT(scatters[TraceCounters::kGuidedScatter]++);
+  } else if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+    return 0.0;
+  }
+
+  double pdf = diffuse_pdf(rec, scattered.direction(), context);
+  if (pdf <= 0) {
+    return 0.0;
+  }
+  attenuation = rec.mat_ptr->eval(rec, scattered.direction()) / pdf;
+  return pdf;
+}
+
+// Radiance of the background for a ray that left the scene. scatter_pdf is
+// described at ray_color.
+inline Color escaped(const Ray& r, const RenderContext& context,
+                     double scatter_pdf) {
+  const EnvironmentMap& background = context.background;
+  if (scatter_pdf > 0 && background.has_distribution()) {
+    return power_heuristic(scatter_pdf, background.pdf(r.direction())) *
+           background.lookup(r.direction());
+  }
+  return background.lookup(r.direction());
+}
+
+inline Color ray_color(const Ray& r, const RenderContext& context, int depth,
+                       double scatter_pdf = 0.0);
+
+// Light leaving the hit point rec towards the origin of r. The scattered part
+// is estimated with the average of paths independent continuations, which is
+// how primary hits are split.
+inline Color shade(const Ray& r, const HitRecord& rec,
+                   const RenderContext& context, int depth, double scatter_pdf,
+                   int paths = 1) {
+  Ray scattered;
+  Color attenuation;
+  // After a diffuse bounce, light from the light tree was sampled directly
+  // and is not counted twice. Other emitters are only found by bouncing.
+  bool count_emitted =
+      scatter_pdf <= 0 || context.lights.empty() || !rec.sampled_light;
+  Color emitted = count_emitted ? rec.mat_ptr->emitted(rec.u, rec.v, rec.p)
+                                : Color(0, 0, 0);
+
+  Color scattered_light(0, 0, 0);
+  for (int k = 0; k < paths; ++k) {
+    if (!rec.mat_ptr->is_diffuse()) {
+      if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        TRACE_STAT(end_path(depth));
+        continue;
+      }
+      continue_cone(r, rec, 0.0, scattered);
+      scattered_light +=
+          attenuation * ray_color(scattered, context, depth - 1);
+      continue;
+    }
+
+    scattered_light += sample_direct_light(rec, r.time(), context) +
+                       sample_environment(rec, r.time(), context);
+
+    double pdf =
+        choose_diffuse_direction(r, rec, context, attenuation, scattered);
+    if (pdf <= 0) {
+      TRACE_STAT(end_path(depth));
+      continue;
+    }
+    continue_cone(r, rec, context.diffuse_spread, scattered);
+
+    Color incoming = ray_color(scattered, context, depth - 1, pdf);
+    if (context.guide) {
+      context.guide->record(rec.p, scattered.direction(),
+                            luminance(incoming) / pdf);
+    }
+    scattered_light += attenuation * incoming;
+  }
+
+  return emitted + scattered_light / paths;
+}
+
+// scatter_pdf is the density with which the diffuse bounce that produced r
+// chose its direction, or 0 for camera and specular rays. After a diffuse
+// bounce the lights in the light tree were already sampled directly, so
+// their emission is skipped and the environment is weighted by MIS.
+inline Color ray_color(const Ray& r, const RenderContext& context, int depth,
+                       double scatter_pdf) {
+  HitRecord rec;
+
+  // If we've exceeded the ray bounce limit, no more light is gathered.
+  if (depth <= 0) {
+    TRACE_STAT(end_path(depth));
+    return Color(0, 0, 0);
+  }
+
+  TRACE_STAT(rays[scatter_pdf > 0 ? TraceCounters::kDiffuseRay
+                                  : TraceCounters::kSpecularRay]++);
+  // If the ray hits nothing, return the background color.
+  if (!context.world.hit(r, 0.001, infinity, rec)) {
+    TRACE_STAT(end_path(depth));
+    return escaped(r, context, scatter_pdf);
+  }
+
+  return shade(r, rec, context, depth, scatter_pdf);
+}
+
+// Traces one camera sample. The primary hit is split into as many secondary
+// paths as its material asks for, so one camera ray covers several indirect
+// estimates. First-hit features are added to features when it is given.
+// sample numbers the pixel's samples for the primary hit cache.
+inline Color sample_pixel(const int& x, const int& y, const int& width,
+                          const int& height, const Camera& camera,
+                          const RenderContext& context, const int& depth,
+                          PixelFeatures* features = nullptr,
+                          unsigned sample = 0) {
+  auto u = (x + random_double()) / (width - 1);
+  auto v = (y + random_double()) / (height - 1);
+  Ray r = camera.get_ray(u, v);
+  r.spread = context.pixel_spread;
+
+  HitRecord rec;
+  if (depth <= 0) {
+    return Color(0, 0, 0);
+  }
+  TRACE_STAT(rays[TraceCounters::kCameraRay]++);
+  TRACE_STAT(path_depth = depth);
+  const Hittable& world =
+      context.camera_world ? *context.camera_world : context.world;
+  bool hit = context.primary_hits
+                 ? context.primary_hits->hit(x, y, sample, world, r, rec)
+                 : world.hit(r, 0.001, infinity, rec);
+  if (!hit) {
+    TRACE_STAT(end_path(depth));
+    Color background = escaped(r, context, 0.0);
+    if (features) {
+      features->albedo += Color(clamp(background.x(), 0, 1),
+                                clamp(background.y(), 0, 1),
+                                clamp(background.z(), 0, 1));
+    }
+    return background;
+  }
+
+  if (features) {
+    features->albedo += rec.mat_ptr->base_color(rec);
+    features->normal += rec.normal;
+    features->depth += rec.t * r.direction().length();
+  }
+  return shade(r, rec, context, depth, 0.0, rec.mat_ptr->split_count());
+}
+
+// Frustum of the camera rays sample_pixel sends for the pixels [x0, x1) x
+// [y0, y1) of an image of the given size.
+inline Frustum tile_frustum(const Camera& camera, int x0, int y0, int x1,
+                            int y1, int width, int height) {
+  return camera.frustum(static_cast<double>(x0) / (width - 1),
+                        static_cast<double>(x1) / (width - 1),
+                        static_cast<double>(y0) / (height - 1),
+                        static_cast<double>(y1) / (height - 1));
+}
+
+// Samples a pass adds to a pixel that has taken some already.
+inline unsigned pass_count(unsigned taken, unsigned spp, unsigned target_spp) {
+  return taken < target_spp ? std::min(spp, target_spp - taken) : 0;
+}
+
+// Takes count samples of pixel (i, j), from sample number first_sample on,
+// and adds them up. Each sample seeds the calling thread's generator from
+// its own number, so its camera ray does not depend on the paths of the
+// samples before it.
+inline void take_samples(int i, int j, unsigned count, const Camera& camera,
+                         const RenderContext& context, int width, int height,
+                         int max_depth, uint64_t seed, unsigned first_sample,
+                         Color& pixel_color, double& luminance_squared,
+                         PixelFeatures& pixel_features) {
+  size_t pixel = i + static_cast<size_t>(j) * width;
+  for (unsigned s = 0; s < count; ++s) {
+    seed_random(Accumulator::pixel_seed(seed, pixel, first_sample + s));
+    Color sample = sample_pixel(i, j, width, height, camera, context,
+                                max_depth, &pixel_features, first_sample + s);
+    pixel_color += sample;
+    luminance_squared += luminance(sample) * luminance(sample);
+  }
+}
+
+#endif  // _RAY_TRACING_LIB_INTEGRATOR_HPP_
@@ -0,0 +1,240 @@
+#ifndef _RAY_TRACING_LIB_LIGHT_TREE_HPP_
+#define _RAY_TRACING_LIB_LIGHT_TREE_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "AxisAlignedBoundingBox.hpp"
+#include "HittableList.hpp"
+#include "common.hpp"
+
+/// @brief Bounds on the position, emission directions and power of a group of
+/// lights. Emission directions are a cone around axis with half-angle theta_o,
+/// and every emitting surface spreads its light over a further theta_e.
+struct LightBounds {
+  AxisAlignedBoundingBox box;
+  Vec3 axis = Vec3(0, 0, 1);
+  double theta_o = pi;
+  double theta_e = pi / 2;
+  double power = 0.0;
+
+  /// @brief Conservative estimate of how much light the group sends towards a
+  /// receiver at p with normal n. Returns zero only when no light in the group
+  /// can reach the receiver.
+  double importance(const Point3& p, const Vec3& n) const {
+    if (power <= 0) {
+      return 0.0;
+    }
+
+    Point3 center = 0.5 * (box.min() + box.max());
+    double radius = 0.5 * (box.max() - box.min()).length();
+    Vec3 to_receiver = p - center;
+    double distance_squared = to_receiver.length_squared();
+
+    // Inside the bounds every direction is possible, so only distance counts.
+    if (distance_squared <= radius * radius) {
+      return power / fmax(distance_squared, 1e-8);
+    }
+
+    double distance = sqrt(distance_squared);
+    Vec3 w = to_receiver / distance;
+    double theta_b = std::asin(radius / distance);
+
+    double theta_w = std::acos(clamp(dot(axis, w), -1.0, 1.0));
+    double theta_prime = fmax(0.0, theta_w - theta_o - theta_b);
+    if (theta_prime >= theta_e) {
+      return 0.0;
+    }
+
+    double cos_receiver = 1.0;
+    if (!n.near_zero()) {
+      double theta_i = std::acos(clamp(dot(n, -w), -1.0, 1.0));
+      double theta_i_prime = fmax(0.0, theta_i - theta_b);
+      if (theta_i_prime >= pi / 2) {
+        return 0.0;
+      }
+      cos_receiver = std::cos(theta_i_prime);
+    }
+
+    return power * std::cos(theta_prime) * cos_receiver / distance_squared;
+  }
+};
+
+/// @brief Rotates v by angle around the unit vector axis (Rodrigues).
+inline Vec3 rotate_about(const Vec3& v, const Vec3& axis, double angle) {
+  double c = std::cos(angle);
+  double s = std::sin(angle);
+  return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1 - c);
+}
+
+LightBounds union_bounds(const LightBounds& a, const LightBounds& b) {
+  if (a.power <= 0) {
+    return b;
+  }
+  if (b.power <= 0) {
+    return a;
+  }
+
+  LightBounds result;
+  result.box = surrounding_box(a.box, b.box);
+  result.power = a.power + b.power;
+  result.theta_e = fmax(a.theta_e, b.theta_e);
+
+  // Smallest cone around both emission cones.
+  double theta_d = std::acos(clamp(dot(a.axis, b.axis), -1.0, 1.0));
+  if (fmin(theta_d + b.theta_o, pi) <= a.theta_o) {
+    result.axis = a.axis;
+    result.theta_o = a.theta_o;
+  } else if (fmin(theta_d + a.theta_o, pi) <= b.theta_o) {
+    result.axis = b.axis;
+    result.theta_o = b.theta_o;
+  } else {
+    double theta_o = (a.theta_o + theta_d + b.theta_o) / 2;
+    Vec3 rotation_axis = cross(a.axis, b.axis);
+    if (theta_o >= pi || rotation_axis.near_zero()) {
+      result.theta_o = pi;
+    } else {
+      result.axis = rotate_about(a.axis, unit_vector(rotation_axis),
+                                 theta_o - a.theta_o);
+      result.theta_o = theta_o;
+    }
+  }
+
+  return result;
+}
+
+/// @brief Bounding hierarchy over the emissive objects of a scene. Picks one
+/// light for a shading point in O(log n) by walking down the tree and choosing
+/// each child in proportion to its estimated importance.
+class LightTree {
+ public:
+  struct Node {
+    LightBounds bounds;
+    int right = -1;  // left child always follows its parent
+    int light = -1;  // index into lights for leaves, -1 for interior nodes
+  };
+
+  LightTree() {}
+  LightTree(const HittableList& list) { build(list.objects); }
+
+  void build(const std::vector<shared_ptr<Hittable>>& objects) {
+    lights.clear();
+    nodes.clear();
+
+    std::vector<LightBounds> bounds;
+    for (const auto& object : objects) {
+      LightBounds b;
+      b.power = object->emitted_power();
+      if (b.power <= 0 || !object->bounding_box(b.box)) {
+        continue;
+      }
+      lights.push_back(object);
+      bounds.push_back(b);
+    }
+
+    if (lights.empty()) {
+      return;
+    }
+
+    std::vector<int> indices(lights.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      indices[i] = static_cast<int>(i);
+    }
+    nodes.reserve(2 * lights.size());
+    build_recursive(bounds, indices, 0, indices.size());
+  }
+
+  bool empty() const { return lights.empty(); }
+  size_t size() const { return lights.size(); }
+
+  /// @brief Chooses a light for the receiver at p with normal n. On success
+  /// pmf holds the probability of having picked the returned light.
+  shared_ptr<Hittable> sample(const Point3& p, const Vec3& n, double u,
+                              double& pmf) const {
+    if (nodes.empty()) {
+      return nullptr;
+    }
+
+    int index = 0;
+    pmf = 1.0;
+
+    if (nodes[0].bounds.importance(p, n) <= 0) {
+      return nullptr;
+    }
+
+    while (nodes[index].light < 0) {
+      double left = nodes[index + 1].bounds.importance(p, n);
+      double right = nodes[nodes[index].right].bounds.importance(p, n);
+      if (left + right <= 0) {
+        return nullptr;
+      }
+
+      double p_left = left / (left + right);
+      if (u < p_left) {
+        u = fmin(u / p_left, 1 - 1e-12);
+        pmf *= p_left;
+        index = index + 1;
+      } else {
+        u = fmin((u - p_left) / (1 - p_left), 1 - 1e-12);
+        pmf *= 1 - p_left;
+        index = nodes[index].right;
+      }
+    }
+
+    return lights[nodes[index].light];
+  }
+
+ public:
+  std::vector<shared_ptr<Hittable>> lights;
+  std::vector<Node> nodes;
+
+ private:
+  int build_recursive(const std::vector<LightBounds>& bounds,
+                      std::vector<int>& indices, size_t start, size_t end) {
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    if (end - start == 1) {
+      nodes[index].bounds = bounds[indices[start]];
+      nodes[index].light = indices[start];
+      return index;
+    }
+
+    // Split at the median centroid along the widest axis, which keeps the
+    // tree balanced and sampling logarithmic in the number of lights.
+    Point3 lo(infinity, infinity, infinity);
+    Point3 hi(-infinity, -infinity, -infinity);
+    for (size_t i = start; i < end; ++i) {
+      Point3 c = centroid(bounds[indices[i]]);
+      for (int a = 0; a < 3; ++a) {
+        lo[a] = fmin(lo[a], c[a]);
+        hi[a] = fmax(hi[a], c[a]);
+      }
+    }
+    Vec3 extent = hi - lo;
+    int axis = (extent.x() > extent.y() && extent.x() > extent.z()) ? 0
+               : (extent.y() > extent.z())                        ? 1
+                                                                  : 2;
+
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(indices.begin() + start, indices.begin() + mid,
+                     indices.begin() + end, [&](int a, int b) {
+                       return centroid(bounds[a])[axis] <
+                              centroid(bounds[b])[axis];
+                     });
+
+    build_recursive(bounds, indices, start, mid);
+    int right = build_recursive(bounds, indices, mid, end);
+
+    nodes[index].right = right;
+    nodes[index].bounds =
+        union_bounds(nodes[index + 1].bounds, nodes[right].bounds);
+    return index;
+  }
+
+  static Point3 centroid(const LightBounds& b) {
+    return 0.5 * (b.box.min() + b.box.max());
+  }
+};
+
+#endif  // _RAY_TRACING_LIB_LIGHT_TREE_HPP_
@@ -0,0 +1,434 @@
+#ifndef _RAY_TRACING_LIB_LINEAR_BVH_HPP_
+#define _RAY_TRACING_LIB_LINEAR_BVH_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "AxisAlignedBoundingBox.hpp"
+#include "Frustum.hpp"
+#include "TraceStats.hpp"
+#include "common.hpp"
+
+/// @brief Node of a BVH flattened into an array in depth-first order. The
+/// first child of an inner node is the node right after it, so only the
+/// second child's index is stored. Bounds are floats rounded outwards, which
+/// keeps a node at 32 bytes, two per cache line.
+struct LinearBvhNode {
+  float min[3];
+  float max[3];
+  uint32_t offset;  // leaf: first primitive, inner: second child
+  uint16_t count;   // primitives in a leaf, 0 for an inner node
+  uint16_t axis;    // split axis, decides which child is visited first
+
+  bool leaf() const { return count > 0; }
+};
+
+/// @brief Precomputed reciprocal direction for repeated ray/box tests.
+struct RayBoxTest {
+  explicit RayBoxTest(const Ray& r) {
+    for (int a = 0; a < 3; ++a) {
+      origin[a] = r.origin()[a];
+      inverse_direction[a] = 1.0 / r.direction()[a];
+      negative[a] = inverse_direction[a] < 0;
+    }
+  }
+
+  /// @brief Slab test against node. Returns the entry distance in t_enter.
+  /// A NaN from a ray lying in a slab plane fails both comparisons and
+  /// leaves the interval alone, which errs on the side of a hit.
+  bool hit(const LinearBvhNode& node, double t_min, double t_max,
+           double& t_enter) const {
+    for (int a = 0; a < 3; ++a) {
+      double t0 = (node.min[a] - origin[a]) * inverse_direction[a];
+      double t1 = (node.max[a] - origin[a]) * inverse_direction[a];
+      if (negative[a]) {
+        std::swap(t0, t1);
+      }
+      t_min = t0 > t_min ? t0 : t_min;
+      t_max = t1 < t_max ? t1 : t_max;
+      if (t_max < t_min) {
+        return false;
+      }
+    }
+    t_enter = t_min;
+    return true;
+  }
+
+  double origin[3];
+  double inverse_direction[3];
+  bool negative[3];
+};
+
+/// @brief Binned surface area heuristic BVH builder producing LinearBvhNode
+/// arrays. The nodes refer to primitives by position in order, so callers
+/// store their primitives in that order and leaves become contiguous ranges.
+/// Nodes are split along the axis where the primitive centroids spread the
+/// most, at the cheapest of bin_count candidate planes.
+class LinearBvh {
+ public:
+  static const int bin_count = 16;
+  // Beyond this depth, splits simply halve the range, which bounds the
+  // tree depth and the traversal stack for any input.
+  static const int max_sah_depth = 48;
+  static const int max_depth = 128;
+  // Frustum culling expands at most this many levels where both children
+  // stay visible, so a tile has at most 2^cull_levels entry nodes.
+  static const int cull_levels = 3;
+  static const int max_entries = 1 << cull_levels;
+
+  /// @brief Most primitives in a leaf.
+  unsigned max_leaf_size = 4;
+  /// @brief When false, every range of at most max_leaf_size primitives
+  /// becomes a leaf, for leaves that are intersected as one packet.
+  bool sah_leaves = true;
+
+  /// @brief Builds over the given primitive bounds.
+  void build(const std::vector<AxisAlignedBoundingBox>& boxes) {
+    build(boxes.size(), [&](size_t i) { return boxes[i]; });
+  }
+
+  /// @brief Builds over count primitives whose bounds box_of(i) returns,
+  /// which spares callers with many primitives an array of boxes.
+  template <typename BoxOf>
+  void build(size_t count, BoxOf box_of) {
+    nodes.clear();
+    order.clear();
+    if (count == 0) {
+      return;
+    }
+
+    // Primitives are moved around as whole records rather than through an
+    // index array, so every pass over a range reads contiguous memory.
+    items_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      AxisAlignedBoundingBox box = box_of(i);
+      Item& item = items_[i];
+      for (int a = 0; a < 3; ++a) {
+        item.lo[a] = round_down(box.min()[a]);
+        item.hi[a] = round_up(box.max()[a]);
+      }
+      item.index = static_cast<uint32_t>(i);
+    }
+
+    nodes.reserve(2 * count);
+    build_node(0, static_cast<uint32_t>(count), 0);
+
+    order.resize(count);
+    for (size_t i = 0; i < items_.size(); ++i) {
+      order[i] = items_[i].index;
+    }
+    items_.clear();
+    items_.shrink_to_fit();
+  }
+
+  /// @brief Visits the leaves hit by r front to back, calling
+  /// hit_leaf(first, count, t_max) for each. hit_leaf returns true and
+  /// lowers t_max when it finds a closer hit.
+  template <typename HitLeaf>
+  static bool traverse(const LinearBvhNode* nodes, size_t node_count,
+                       const Ray& r, double t_min, double& t_max,
+                       HitLeaf hit_leaf) {
+    const uint32_t root = 0;
+    return traverse(nodes, &root, node_count > 0 ? 1 : 0, r, t_min, t_max,
+                    hit_leaf);
+  }
+
+  /// @brief Like traverse() from the root, but starting at entry_count
+  /// entry nodes from cull(), visited in their order.
+  template <typename HitLeaf>
+  static bool traverse(const LinearBvhNode* nodes, const uint32_t* entries,
+                       size_t entry_count, const Ray& r, double t_min,
+                       double& t_max, HitLeaf hit_leaf) {
+    if (entry_count == 0) {
+      return false;
+    }
+
+    RayBoxTest test(r);
+    uint32_t stack[max_depth + max_entries];
+    int top = 0;
+    for (size_t k = entry_count - 1; k > 0; --k) {
+      stack[top++] = entries[k];
+    }
+    uint32_t current = entries[0];
+    bool hit_anything = false;
+    // Counted here and added once, to keep counting out of the loop.
+    [[maybe_unused]] uint64_t visited = 0;
+
+    while (true) {
+      const LinearBvhNode& node = nodes[current];
+      ++visited;
+      double t_enter;
+      if (test.hit(node, t_min, t_max, t_enter)) {
+        if (node.leaf()) {
+          hit_anything |= hit_leaf(node.offset, node.count, t_max);
+        } else {
+          // Visit the child on the side the ray comes from first.
+          uint32_t first = current + 1;
+          uint32_t second = node.offset;
+          if (test.negative[node.axis]) {
+            std::swap(first, second);
+          }
+          stack[top++] = second;
+          current = first;
+          continue;
+        }
+      }
+      if (top == 0) {
+        break;
+      }
+      current = stack[--top];
+    }
+    TRACE_STAT(node_visits += visited);
+    TRACE_STAT(box_tests += visited);
+    return hit_anything;
+  }
+
+  /// @brief The nodes below which every ray of frustum's tile finds all it
+  /// can hit, into entries, near ones first. Subtrees the tile can not see
+  /// are left out, and a node with one visible child is replaced by it.
+  static void cull(const LinearBvhNode* nodes, size_t node_count,
+                   const Frustum& frustum, std::vector<uint32_t>& entries) {
+    entries.clear();
+    if (node_count > 0 && !frustum.excludes(nodes[0].min, nodes[0].max)) {
+      cull_node(nodes, 0, frustum, cull_levels, entries);
+    }
+  }
+
+  template <typename HitLeaf>
+  bool traverse(const Ray& r, double t_min, double& t_max,
+                HitLeaf hit_leaf) const {
+    return traverse(nodes.data(), nodes.size(), r, t_min, t_max, hit_leaf);
+  }
+
+  /// @brief Converts double bounds to float ones that still enclose them.
+  static void store_bounds(const AxisAlignedBoundingBox& box,
+                           LinearBvhNode& node) {
+    for (int a = 0; a < 3; ++a) {
+      node.min[a] = round_down(box.min()[a]);
+      node.max[a] = round_up(box.max()[a]);
+    }
+  }
+
+  /// @brief The largest float not above x.
+  static float round_down(double x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -INFINITY) : f;
+  }
+
+  /// @brief The smallest float not below x.
+  static float round_up(double x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, INFINITY) : f;
+  }
+
+  std::vector<LinearBvhNode> nodes;
+  std::vector<uint32_t> order;  // primitive indices in leaf order
+
+ private:
+  // Adds entries for the visible node index.
+  static void cull_node(const LinearBvhNode* nodes, uint32_t index,
+                        const Frustum& frustum, int levels,
+                        std::vector<uint32_t>& entries) {
+    const LinearBvhNode& node = nodes[index];
+    if (node.leaf() || levels == 0) {
+      entries.push_back(index);
+      return;
+    }
+
+    uint32_t first = index + 1;
+    uint32_t second = node.offset;
+    if (frustum.direction[node.axis] < 0) {
+      std::swap(first, second);
+    }
+    bool first_visible =
+        !frustum.excludes(nodes[first].min, nodes[first].max);
+    bool second_visible =
+        !frustum.excludes(nodes[second].min, nodes[second].max);
+    int next = first_visible && second_visible ? levels - 1 : levels;
+    if (first_visible) {
+      cull_node(nodes, first, frustum, next, entries);
+    }
+    if (second_visible) {
+      cull_node(nodes, second, frustum, next, entries);
+    }
+  }
+
+  struct Bounds {
+    double lo[3] = {infinity, infinity, infinity};
+    double hi[3] = {-infinity, -infinity, -infinity};
+
+    void grow(const Bounds& b) {
+      for (int a = 0; a < 3; ++a) {
+        lo[a] = std::min(lo[a], b.lo[a]);
+        hi[a] = std::max(hi[a], b.hi[a]);
+      }
+    }
+
+    void grow(const float* box_lo, const float* box_hi) {
+      for (int a = 0; a < 3; ++a) {
+        lo[a] = std::min(lo[a], static_cast<double>(box_lo[a]));
+        hi[a] = std::max(hi[a], static_cast<double>(box_hi[a]));
+      }
+    }
+
+    void grow(const double* p) {
+      for (int a = 0; a < 3; ++a) {
+        lo[a] = std::min(lo[a], p[a]);
+        hi[a] = std::max(hi[a], p[a]);
+      }
+    }
+
+    double area() const {
+      double dx = hi[0] - lo[0];
+      double dy = hi[1] - lo[1];
+      double dz = hi[2] - lo[2];
+      return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+  };
+
+  // Bounds are already rounded to floats, which is all the nodes keep, and
+  // the centroid is derived from them. 28 bytes a primitive.
+  struct Item {
+    float lo[3];
+    float hi[3];
+    uint32_t index;
+
+    double centroid(int a) const { return 0.5 * (double(lo[a]) + hi[a]); }
+  };
+
+  struct Bin {
+    Bounds box;
+    uint32_t count = 0;
+  };
+
+  // Builds the node over items_[begin, end) and returns its index. Children
+  // are built depth first so the first child lands right after its parent.
+  uint32_t build_node(uint32_t begin, uint32_t end, int depth) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    Bounds bounds;
+    Bounds centroid_bounds;
+    for (uint32_t i = begin; i < end; ++i) {
+      double centroid[3];
+      for (int a = 0; a < 3; ++a) {
+        centroid[a] = items_[i].centroid(a);
+      }
+      bounds.grow(items_[i].lo, items_[i].hi);
+      centroid_bounds.grow(centroid);
+    }
+    store_bounds(AxisAlignedBoundingBox(
+                     Point3(bounds.lo[0], bounds.lo[1], bounds.lo[2]),
+                     Point3(bounds.hi[0], bounds.hi[1], bounds.hi[2])),
+                 nodes[index]);
+
+    uint32_t count = end - begin;
+    int axis = 0;
+    uint32_t mid = begin;
+    bool split = false;
+    if (depth >= max_sah_depth) {
+      split = count > max_leaf_size;
+      mid = begin + count / 2;
+    } else if (count > 1 && (sah_leaves || count > max_leaf_size)) {
+      split = choose_split(begin, end, bounds, centroid_bounds, axis, mid);
+    }
+
+    if (split) {
+      nodes[index].axis = static_cast<uint16_t>(axis);
+      nodes[index].count = 0;
+      build_node(begin, mid, depth + 1);
+      uint32_t second = build_node(mid, end, depth + 1);
+      nodes[index].offset = second;
+    } else {
+      nodes[index].offset = begin;
+      nodes[index].count = static_cast<uint16_t>(count);
+      nodes[index].axis = 0;
+    }
+    return index;
+  }
+
+  // Picks the cheapest binned SAH split along the axis where the centroids
+  // spread the most, and partitions the range around it. Returns false when
+  // a leaf is cheaper.
+  bool choose_split(uint32_t begin, uint32_t end, const Bounds& bounds,
+                    const Bounds& centroid_bounds, int& axis, uint32_t& mid) {
+    uint32_t count = end - begin;
+    bool must_split = count > max_leaf_size;
+
+    axis = 0;
+    for (int a = 1; a < 3; ++a) {
+      if (centroid_bounds.hi[a] - centroid_bounds.lo[a] >
+          centroid_bounds.hi[axis] - centroid_bounds.lo[axis]) {
+        axis = a;
+      }
+    }
+    double lo = centroid_bounds.lo[axis];
+    double extent = centroid_bounds.hi[axis] - lo;
+    if (!(extent > 0)) {
+      // All centroids coincide: split the range in half.
+      mid = begin + count / 2;
+      return must_split;
+    }
+
+    double scale = bin_count / extent;
+    auto bin_of = [&](const Item& item) {
+      return std::min(bin_count - 1,
+                      static_cast<int>((item.centroid(axis) - lo) * scale));
+    };
+
+    Bin bins[bin_count];
+    for (uint32_t i = begin; i < end; ++i) {
+      Bin& bin = bins[bin_of(items_[i])];
+      bin.box.grow(items_[i].lo, items_[i].hi);
+      bin.count++;
+    }
+
+    // Sweep from the right to get the cost of every split plane.
+    double right_area[bin_count];
+    uint32_t right_count[bin_count];
+    Bounds box;
+    uint32_t n = 0;
+    for (int b = bin_count - 1; b > 0; --b) {
+      box.grow(bins[b].box);
+      n += bins[b].count;
+      right_area[b] = n ? box.area() : 0;
+      right_count[b] = n;
+    }
+
+    double best_cost = infinity;
+    int best_bin = -1;
+    box = Bounds();
+    n = 0;
+    for (int b = 0; b < bin_count - 1; ++b) {
+      box.grow(bins[b].box);
+      n += bins[b].count;
+      if (n == 0 || right_count[b + 1] == 0) {
+        continue;
+      }
+      double cost = n * box.area() + right_count[b + 1] * right_area[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_bin = b;
+      }
+    }
+
+    // Traversal is taken to cost about as much as one intersection.
+    double leaf_cost = count * bounds.area();
+    double split_cost = bounds.area() + best_cost;
+    if (!must_split && leaf_cost <= split_cost) {
+      return false;
+    }
+
+    auto middle = std::partition(
+        items_.begin() + begin, items_.begin() + end,
+        [&](const Item& item) { return bin_of(item) <= best_bin; });
+    mid = static_cast<uint32_t>(middle - items_.begin());
+    return true;
+  }
+
+  std::vector<Item> items_;
+};
+
+#endif  // _RAY_TRACING_LIB_LINEAR_BVH_HPP_
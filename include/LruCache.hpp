@@ -0,0 +1,58 @@
+#ifndef _RAY_TRACING_LIB_LRU_CACHE_HPP_
+#define _RAY_TRACING_LIB_LRU_CACHE_HPP_
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+/// @brief Keeps the capacity most recently used values. Values are shared,
+/// so one that is evicted while in use lives on until its last user lets
+/// go of it.
+template <typename Key, typename Value>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {}
+
+  /// @brief The value for key, now the most recently used, or nullptr.
+  std::shared_ptr<Value> find(const Key& key) {
+    auto found = index_.find(key);
+    if (found == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, found->second);
+    return found->second->second;
+  }
+
+  /// @brief Stores value for key as the most recently used one, evicting
+  /// the least recently used beyond the capacity.
+  void insert(const Key& key, std::shared_ptr<Value> value) {
+    erase(key);
+    entries_.emplace_front(key, std::move(value));
+    index_[key] = entries_.begin();
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  void erase(const Key& key) {
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+      entries_.erase(found->second);
+      index_.erase(found);
+    }
+  }
+
+  size_t size() const { return entries_.size(); }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  using Entry = std::pair<Key, std::shared_ptr<Value>>;
+
+  size_t capacity_;
+  std::list<Entry> entries_;  // most recently used first
+  std::unordered_map<Key, typename std::list<Entry>::iterator> index_;
+};
+
+#endif  // _RAY_TRACING_LIB_LRU_CACHE_HPP_
@@ -3,6 +3,7 @@
 
 #include "Hittable.hpp"
 #include "Texture.hpp"
+#include "TraceStats.hpp"
 #include "common.hpp"
 
 class Material {
@@ -13,6 +14,30 @@ class Material {
   virtual Color emitted(double u, double v, const Point3& p) const {
     return Color(0, 0, 0);
   };
+
+  /// @brief Returns true when the material can be lit by explicit light
+  /// sampling, i.e. eval() gives its full response for any direction.
+  virtual bool is_diffuse() const { return false; }
+
+  /// @brief Number of secondary paths to trace from a primary hit.
+  virtual int split_count() const { return 1; }
+
+  /// @brief Surface color at the hit, written to the albedo AOV.
+  virtual Color base_color(const HitRecord& rec) const {
+    return Color(1, 1, 1);
+  }
+
+  /// @brief Evaluates BRDF * cos(theta) for light arriving from direction.
+  virtual Color eval(const HitRecord& rec, const Vec3& direction) const {
+    return Color(0, 0, 0);
+  }
+
+  /// @brief Solid angle density of scatter() choosing direction. Only
+  /// meaningful for diffuse materials.
+  virtual double scattering_pdf(const HitRecord& rec,
+                                const Vec3& direction) const {
+    return 0.0;
+  }
 };
 
 class Lambertian : public Material {
@@ -22,6 +47,7 @@ class Lambertian : public Material {
 
   virtual bool scatter(const Ray& r_in, const HitRecord& rec,
                        Color& attenuation, Ray& scattered) const override {
+    TRACE_STAT(scatters[TraceCounters::kLambertianScatter]++);
     auto scatter_direction = rec.normal + random_unit_vector();
 
     // Catch degenerate scatter direction
@@ -29,12 +55,40 @@ class Lambertian : public Material {
       scatter_direction = rec.normal;
     }
 
-    scattered = Ray(rec.p, scatter_direction);
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    scattered = Ray(rec.p, scatter_direction, r_in.time());
+    attenuation =
+        albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
     return true;
   }
 
+  virtual bool is_diffuse() const override { return true; }
+
+  virtual int split_count() const override { return splits; }
+
+  virtual Color base_color(const HitRecord& rec) const override {
+    return albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
+  }
+
+  virtual Color eval(const HitRecord& rec,
+                     const Vec3& direction) const override {
+    auto cosine = dot(rec.normal, unit_vector(direction));
+    if (cosine <= 0) {
+      return Color(0, 0, 0);
+    }
+    return albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint) *
+           (cosine / pi);
+  }
+
+  virtual double scattering_pdf(const HitRecord& rec,
+                                const Vec3& direction) const override {
+    auto cosine = dot(rec.normal, unit_vector(direction));
+    return cosine <= 0 ? 0 : cosine / pi;
+  }
+
   shared_ptr<Texture> albedo;
+
+  /// @brief Paths traced from primary hits on any Lambertian.
+  inline static int splits = 1;
 };
 
 class Metal : public Material {
@@ -43,15 +97,26 @@ class Metal : public Material {
 
   virtual bool scatter(const Ray& r_in, const HitRecord& rec,
                        Color& attenuation, Ray& scattered) const override {
+    TRACE_STAT(scatters[TraceCounters::kMetalScatter]++);
     Vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-    scattered = Ray(rec.p, reflected + fuzz * random_in_unit_sphere());
+    scattered = Ray(rec.p, reflected + fuzz * random_in_unit_sphere(),
+                    r_in.time());
     attenuation = albedo;
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
+  virtual int split_count() const override { return splits; }
+
+  virtual Color base_color(const HitRecord& rec) const override {
+    return albedo;
+  }
+
  public:
   Color albedo;
   double fuzz;
+
+  /// @brief Paths traced from primary hits on any Metal.
+  inline static int splits = 1;
 };
 
 class Dielectric : public Material {
@@ -61,6 +126,7 @@ class Dielectric : public Material {
 
   virtual bool scatter(const Ray& r_in, const HitRecord& rec,
                        Color& attenuation, Ray& scattered) const override {
+    TRACE_STAT(scatters[TraceCounters::kDielectricScatter]++);
     attenuation = Color(1.0, 1.0, 1.0);
     double refraction_ratio =
         rec.front_face ? (1.0 / refraction_index) : refraction_index;
@@ -76,13 +142,18 @@ class Dielectric : public Material {
             ? reflect(unit_direction, rec.normal)
             : refract(unit_direction, rec.normal, refraction_ratio);
 
-    scattered = Ray(rec.p, direction);
+    scattered = Ray(rec.p, direction, r_in.time());
     return true;
   }
 
+  virtual int split_count() const override { return splits; }
+
  public:
   double refraction_index;
 
+  /// @brief Paths traced from primary hits on any Dielectric.
+  inline static int splits = 1;
+
  private:
   // Approximates reflectance using a method by Christophe Schlick
   static double reflectance(double cosine, double ref_index) {
@@ -99,6 +170,7 @@ class DiffuseLight : public Material {
 
   virtual bool scatter(const Ray& r_in, const HitRecord& rec,
                        Color& attenuation, Ray& scattered) const override {
+    TRACE_STAT(scatters[TraceCounters::kLightScatter]++);
     return false;
   }
 
@@ -106,6 +178,11 @@ class DiffuseLight : public Material {
     return emit->value(u, v, p);
   }
 
+  virtual Color base_color(const HitRecord& rec) const override {
+    Color c = emit->value(rec.u, rec.v, rec.p);
+    return Color(clamp(c.x(), 0, 1), clamp(c.y(), 0, 1), clamp(c.z(), 0, 1));
+  }
+
  public:
   shared_ptr<Texture> emit;
 };
@@ -0,0 +1,126 @@
+#ifndef _RAY_TRACING_LIB_MOTION_BVH_HPP_
+#define _RAY_TRACING_LIB_MOTION_BVH_HPP_
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "Hittable.hpp"
+#include "LinearBvh.hpp"
+#include "common.hpp"
+
+/// @brief BVH over moving objects with separate bounds for each of
+/// segment_count slices of [time0, time1].
+///
+/// The tree is built once, over the bounds of the whole motion, and then
+/// refit for every time segment. A ray only tests the boxes of the segment
+/// its time falls in, which hug the objects far tighter than boxes around
+/// everywhere they go.
+class MotionBvh : public Hittable {
+ public:
+  static const int segment_count = 8;
+
+  MotionBvh(std::vector<shared_ptr<Hittable>> objects, double time0 = 0.0,
+            double time1 = 1.0)
+      : time0_(time0), time1_(time1) {
+    std::vector<AxisAlignedBoundingBox> boxes(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+      if (!objects[i]->bounding_box(boxes[i])) {
+        std::cerr << "No bounding box in MotionBvh constructor.\n";
+      }
+    }
+
+    LinearBvh bvh;
+    bvh.build(boxes);
+    for (uint32_t index : bvh.order) {
+      objects_.push_back(objects[index]);
+    }
+
+    for (int s = 0; s < segment_count; ++s) {
+      std::vector<LinearBvhNode> nodes = bvh.nodes;
+      if (!nodes.empty()) {
+        refit(nodes, 0, segment_start(s), segment_start(s + 1));
+      }
+      segments_.push_back(std::move(nodes));
+    }
+  }
+
+  virtual bool hit(const Ray& r, double t_min, double t_max,
+                   HitRecord& rec) const override {
+    // Before time0 and after time1 objects rest where their motion starts
+    // and ends, which the first and last segments cover.
+    double position = (r.time() - time0_) / (time1_ - time0_) * segment_count;
+    int s = 0;
+    if (position >= segment_count) {
+      s = segment_count - 1;
+    } else if (position > 0) {
+      s = static_cast<int>(position);
+    }
+
+    const std::vector<LinearBvhNode>& nodes = segments_[s];
+    return LinearBvh::traverse(
+        nodes.data(), nodes.size(), r, t_min, t_max,
+        [&](uint32_t first, uint32_t count, double& t_far) {
+          bool hit_anything = false;
+          for (uint32_t i = first; i < first + count; ++i) {
+            if (objects_[i]->hit(r, t_min, t_far, rec)) {
+              t_far = rec.t;
+              hit_anything = true;
+            }
+          }
+          return hit_anything;
+        });
+  }
+
+  virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override {
+    if (segments_.empty() || segments_[0].empty()) {
+      return false;
+    }
+    // The root of every segment, together.
+    output_box = node_box(segments_[0][0]);
+    for (const auto& nodes : segments_) {
+      output_box = surrounding_box(output_box, node_box(nodes[0]));
+    }
+    return true;
+  }
+
+ private:
+  double segment_start(int s) const {
+    return time0_ + (time1_ - time0_) * s / segment_count;
+  }
+
+  static AxisAlignedBoundingBox node_box(const LinearBvhNode& node) {
+    return AxisAlignedBoundingBox(
+        Point3(node.min[0], node.min[1], node.min[2]),
+        Point3(node.max[0], node.max[1], node.max[2]));
+  }
+
+  // Recomputes the bounds of node and its subtree for the objects' motion
+  // from time0 to time1, and returns them.
+  AxisAlignedBoundingBox refit(std::vector<LinearBvhNode>& nodes,
+                               uint32_t index, double time0, double time1) {
+    LinearBvhNode& node = nodes[index];
+    AxisAlignedBoundingBox box;
+    if (node.leaf()) {
+      objects_[node.offset]->motion_bounds(time0, time1, box);
+      for (uint32_t i = node.offset + 1; i < node.offset + node.count; ++i) {
+        AxisAlignedBoundingBox object_box;
+        objects_[i]->motion_bounds(time0, time1, object_box);
+        box = surrounding_box(box, object_box);
+      }
+    } else {
+      uint32_t second = node.offset;
+      box = surrounding_box(refit(nodes, index + 1, time0, time1),
+                            refit(nodes, second, time0, time1));
+    }
+    LinearBvh::store_bounds(box, nodes[index]);
+    return box;
+  }
+
+  double time0_;
+  double time1_;
+  std::vector<shared_ptr<Hittable>> objects_;  // in leaf order
+  std::vector<std::vector<LinearBvhNode>> segments_;
+};
+
+#endif  // _RAY_TRACING_LIB_MOTION_BVH_HPP_
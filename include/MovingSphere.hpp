@@ -0,0 +1,123 @@
+#ifndef _RAY_TRACING_LIB_MOVING_SPHERE_HPP_
+#define _RAY_TRACING_LIB_MOVING_SPHERE_HPP_
+
+#include <vector>
+
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "Vec3.hpp"
+
+/// @brief Sphere whose center moves through keyframes spread evenly over
+/// [time0, time1], interpolated linearly in between. Before time0 and after
+/// time1 it rests at the first and the last keyframe.
+class MovingSphere : public Hittable {
+ public:
+  MovingSphere() {}
+  MovingSphere(std::vector<Point3> centers, double r, shared_ptr<Material> m,
+               double time0 = 0.0, double time1 = 1.0)
+      : centers(std::move(centers)),
+        radius(r),
+        mat_ptr(m),
+        time0(time0),
+        time1(time1) {}
+
+  Point3 center(double time) const;
+
+  virtual bool hit(const Ray& r, double t_min, double t_max,
+                   HitRecord& rec) const override;
+  virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override;
+  virtual bool motion_bounds(double from, double to,
+                             AxisAlignedBoundingBox& output_box) const override;
+
+ public:
+  std::vector<Point3> centers;
+  double radius;
+  shared_ptr<Material> mat_ptr;
+  double time0, time1;
+
+ private:
+  // Position of time between the keyframes, from 0 to centers.size() - 1.
+  double keyframe(double time) const {
+    if (centers.size() < 2 || !(time1 > time0)) {
+      return 0.0;
+    }
+    double k = (time - time0) / (time1 - time0) * (centers.size() - 1);
+    return clamp(k, 0.0, static_cast<double>(centers.size() - 1));
+  }
+
+  AxisAlignedBoundingBox box_at(const Point3& c) const {
+    return AxisAlignedBoundingBox(c - Vec3(radius, radius, radius),
+                                  c + Vec3(radius, radius, radius));
+  }
+};
+
+Point3 MovingSphere::center(double time) const {
+  double k = keyframe(time);
+  size_t i = std::min(static_cast<size_t>(k), centers.size() - 1);
+  if (i + 1 == centers.size()) {
+    return centers[i];
+  }
+  double f = k - i;
+  return (1 - f) * centers[i] + f * centers[i + 1];
+}
+
+bool MovingSphere::hit(const Ray& r, double t_min, double t_max,
+                       HitRecord& rec) const {
+  TRACE_STAT(sphere_tests++);
+  Point3 c = center(r.time());
+  Vec3 oc = r.origin() - c;
+  auto a = r.direction().length_squared();
+  auto half_b = dot(oc, r.direction());
+  auto cc = oc.length_squared() - radius * radius;
+
+  auto discriminant = half_b * half_b - a * cc;
+  if (discriminant < 0) {
+    return false;
+  }
+  auto sqrtd = sqrt(discriminant);
+
+  auto root = (-half_b - sqrtd) / a;
+  if (root < t_min || t_max < root) {
+    root = (-half_b + sqrtd) / a;
+    if (root < t_min || t_max < root) {
+      return false;
+    }
+  }
+
+  rec.t = root;
+  rec.p = r.at(rec.t);
+  Vec3 outward_normal = (rec.p - c) / radius;
+  rec.set_face_normal(r, outward_normal);
+  Sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+  rec.footprint = r.width_at(rec.t) / (pi * radius);
+  rec.mat_ptr = mat_ptr;
+  rec.primitive = HitRecord::kNoPrimitive;
+  rec.sampled_light = false;
+  TRACE_STAT(sphere_hits++);
+
+  return true;
+}
+
+bool MovingSphere::bounding_box(AxisAlignedBoundingBox& output_box) const {
+  return motion_bounds(-infinity, infinity, output_box);
+}
+
+bool MovingSphere::motion_bounds(double from, double to,
+                                 AxisAlignedBoundingBox& output_box) const {
+  if (centers.empty()) {
+    return false;
+  }
+
+  // The path is piecewise linear, so its ends and the keyframes passed in
+  // between bound it exactly.
+  output_box = surrounding_box(box_at(center(from)), box_at(center(to)));
+  double first = keyframe(from);
+  double last = keyframe(to);
+  for (size_t i = static_cast<size_t>(std::ceil(first)); i < last; ++i) {
+    output_box = surrounding_box(output_box, box_at(centers[i]));
+  }
+  return true;
+}
+
+#endif  // _RAY_TRACING_LIB_MOVING_SPHERE_HPP_
@@ -0,0 +1,179 @@
+#ifndef _RAY_TRACING_LIB_OBJ_LOADER_HPP_
+#define _RAY_TRACING_LIB_OBJ_LOADER_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "TriangleMesh.hpp"
+#include "common.hpp"
+
+/// @brief Reads the geometry of a Wavefront OBJ file: positions, normals,
+/// texture coordinates and faces. Polygons are split into triangle fans and
+/// every distinct position/uv/normal combination becomes one vertex of the
+/// indexed mesh. Materials, groups and other statements are ignored.
+/// Returns nullptr after reporting the first error.
+inline shared_ptr<MeshData> load_obj(const std::string& file_name) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) {
+    std::cerr << "Cannot open mesh " << file_name << ".\n";
+    return nullptr;
+  }
+  file.seekg(0, std::ios::end);
+  std::string text(static_cast<size_t>(file.tellg()), '\0');
+  file.seekg(0);
+  file.read(&text[0], text.size());
+
+  std::vector<Point3> file_positions;
+  std::vector<Vec3> file_normals;
+  std::vector<TexCoord> file_uvs;
+
+  std::vector<Point3> positions;
+  std::vector<Vec3> normals;
+  std::vector<TexCoord> uvs;
+  std::vector<uint32_t> indices;
+  std::unordered_map<uint64_t, uint32_t> vertices;
+  std::vector<uint32_t> polygon;
+  bool with_normals = true;
+  bool with_uvs = true;
+
+  // Positions, uvs and normals each get 21 bits of a vertex key.
+  const size_t kMaxVertices = size_t(1) << 21;
+  size_t line_number = 0;
+  auto fail = [&](const char* message) {
+    std::cerr << file_name << ":" << line_number << ": " << message << "\n";
+    return nullptr;
+  };
+
+  // Resolves a 1-based or negative (relative to the end) index.
+  auto resolve = [](long index, size_t count, size_t& out) {
+    if (index > 0 && static_cast<size_t>(index) <= count) {
+      out = static_cast<size_t>(index) - 1;
+      return true;
+    }
+    if (index < 0 && static_cast<size_t>(-index) <= count) {
+      out = count - static_cast<size_t>(-index);
+      return true;
+    }
+    return false;
+  };
+
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = text.find('\n', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string line(text, begin, end - begin);
+    begin = end + 1;
+    ++line_number;
+
+    const char* p = line.c_str();
+    while (*p == ' ' || *p == '\t') {
+      ++p;
+    }
+    char* next;
+    if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+      double x = strtod(p + 2, &next);
+      double y = strtod(next, &next);
+      double z = strtod(next, &next);
+      file_positions.emplace_back(x, y, z);
+    } else if (p[0] == 'v' && p[1] == 'n') {
+      double x = strtod(p + 2, &next);
+      double y = strtod(next, &next);
+      double z = strtod(next, &next);
+      file_normals.emplace_back(x, y, z);
+    } else if (p[0] == 'v' && p[1] == 't') {
+      double u = strtod(p + 2, &next);
+      double v = strtod(next, &next);
+      file_uvs.push_back({u, v});
+    } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+      polygon.clear();
+      p += 2;
+      while (true) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') {
+          ++p;
+        }
+        if (*p == '\0') {
+          break;
+        }
+
+        // v, v/vt, v//vn or v/vt/vn.
+        long v = strtol(p, &next, 10);
+        if (next == p) {
+          return fail("Malformed face.");
+        }
+        p = next;
+        long vt = 0;
+        long vn = 0;
+        if (*p == '/') {
+          ++p;
+          if (*p != '/') {
+            vt = strtol(p, &next, 10);
+            p = next;
+          }
+          if (*p == '/') {
+            vn = strtol(p + 1, &next, 10);
+            p = next;
+          }
+        }
+
+        size_t position, uv = 0, normal = 0;
+        if (!resolve(v, file_positions.size(), position) ||
+            (vt && !resolve(vt, file_uvs.size(), uv)) ||
+            (vn && !resolve(vn, file_normals.size(), normal))) {
+          return fail("Face index out of range.");
+        }
+        if (position >= kMaxVertices || uv + 1 >= kMaxVertices ||
+            normal + 1 >= kMaxVertices) {
+          return fail("Too many vertices.");
+        }
+        with_uvs &= vt != 0;
+        with_normals &= vn != 0;
+
+        uint64_t key = position |
+                       static_cast<uint64_t>(vt ? uv + 1 : 0) << 21 |
+                       static_cast<uint64_t>(vn ? normal + 1 : 0) << 42;
+        auto inserted = vertices.emplace(key, positions.size());
+        if (inserted.second) {
+          positions.push_back(file_positions[position]);
+          normals.push_back(vn ? file_normals[normal] : Vec3(0, 0, 0));
+          uvs.push_back(vt ? file_uvs[uv] : TexCoord{0, 0});
+        }
+        polygon.push_back(inserted.first->second);
+      }
+
+      if (polygon.size() < 3) {
+        return fail("Face with fewer than three vertices.");
+      }
+      for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[k]);
+        indices.push_back(polygon[k + 1]);
+      }
+    }
+  }
+
+  if (indices.empty()) {
+    std::cerr << "Mesh " << file_name << " has no faces.\n";
+    return nullptr;
+  }
+
+  // Normals and uvs are only used when every face has them.
+  if (!with_normals) {
+    normals.clear();
+  }
+  if (!with_uvs) {
+    uvs.clear();
+  }
+  auto data = make_shared<MeshData>(std::move(positions), std::move(normals),
+                                    std::move(uvs), std::move(indices));
+  data->file_hash = hash_bytes(text.data(), text.size());
+  return data;
+}
+
+#endif  // _RAY_TRACING_LIB_OBJ_LOADER_HPP_
@@ -0,0 +1,245 @@
+#ifndef _RAY_TRACING_LIB_PATH_GUIDE_HPP_
+#define _RAY_TRACING_LIB_PATH_GUIDE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "AxisAlignedBoundingBox.hpp"
+#include "common.hpp"
+
+/// @brief Piecewise-constant distribution over the sphere of directions.
+/// Bins are equal-area cells of the (cos theta, phi) cylinder, so a bin's
+/// probability divided by its solid angle gives the density directly.
+class DirectionalDistribution {
+ public:
+  static const int cos_bins = 12;
+  static const int phi_bins = 24;
+  static const int bin_count = cos_bins * phi_bins;
+
+  bool valid() const { return !cdf.empty(); }
+
+  /// @brief Builds the CDF from bin weights. A small uniform part keeps every
+  /// direction reachable even where nothing has been learned yet.
+  void build(const float* weights) {
+    double total = 0;
+    for (int i = 0; i < bin_count; ++i) {
+      total += weights[i];
+    }
+    if (!(total > 0) || !std::isfinite(total)) {
+      cdf.clear();
+      return;
+    }
+
+    const double uniform = 0.1;
+    cdf.assign(bin_count + 1, 0.0);
+    for (int i = 0; i < bin_count; ++i) {
+      double p = (1 - uniform) * weights[i] / total + uniform / bin_count;
+      cdf[i + 1] = cdf[i] + p;
+    }
+  }
+
+  Vec3 sample(double u1, double u2, double u3, double& pdf) const {
+    double target = u1 * cdf.back();
+    auto it = std::upper_bound(cdf.begin() + 1, cdf.end(), target);
+    int bin = std::min(static_cast<int>(it - cdf.begin()) - 1, bin_count - 1);
+
+    int c = bin / phi_bins;
+    int ph = bin % phi_bins;
+    double z = -1 + 2 * (c + u2) / cos_bins;
+    double phi = 2 * pi * (ph + u3) / phi_bins;
+    double r = sqrt(fmax(0.0, 1 - z * z));
+
+    pdf = bin_pdf(bin);
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+  }
+
+  double pdf(const Vec3& direction) const { return bin_pdf(bin_of(direction)); }
+
+  static int bin_of(const Vec3& direction) {
+    Vec3 d = unit_vector(direction);
+    double phi = std::atan2(d.y(), d.x());
+    if (phi < 0) {
+      phi += 2 * pi;
+    }
+    int c = static_cast<int>((d.z() + 1) * 0.5 * cos_bins);
+    int ph = static_cast<int>(phi / (2 * pi) * phi_bins);
+    c = std::clamp(c, 0, cos_bins - 1);
+    ph = std::clamp(ph, 0, phi_bins - 1);
+    return c * phi_bins + ph;
+  }
+
+ public:
+  std::vector<double> cdf;
+
+ private:
+  double bin_pdf(int bin) const {
+    // Every bin covers 4 pi / bin_count steradians.
+    return (cdf[bin + 1] - cdf[bin]) * bin_count / (4 * pi);
+  }
+};
+
+/// @brief Spatial cell of the guiding tree. Render threads splat into the
+/// recording bins concurrently while sampling from the distribution learned
+/// in the previous pass.
+struct GuideLeaf {
+  std::atomic<float> bins[DirectionalDistribution::bin_count];
+  std::atomic<unsigned> samples{0};
+  DirectionalDistribution distribution;
+
+  GuideLeaf() { clear_bins(); }
+
+  void clear_bins() {
+    for (auto& b : bins) {
+      b.store(0.0f, std::memory_order_relaxed);
+    }
+    samples.store(0, std::memory_order_relaxed);
+  }
+};
+
+/// @brief Online path guiding in the style of an SD-tree: a binary tree over
+/// space, split along alternating axes, whose leaves hold directional
+/// histograms of incident radiance.
+///
+/// Each pass records into the leaves while sampling from what was learned in
+/// the pass before. refine() is called between passes, with no render thread
+/// running, to turn the histograms into distributions and to subdivide leaves
+/// that received many samples.
+class PathGuide {
+ public:
+  struct Node {
+    AxisAlignedBoundingBox box;
+    int child = -1;  // first of two children, -1 for a leaf
+    int leaf = -1;
+    int depth = 0;
+  };
+
+  PathGuide(const AxisAlignedBoundingBox& bounds) {
+    nodes.push_back({bounds, -1, 0, 0});
+    leaves.push_back(std::make_unique<GuideLeaf>());
+  }
+
+  /// @brief Probability of sampling the guide instead of the BRDF.
+  double sampling_fraction = 0.5;
+  /// @brief Recording is skipped when false, e.g. in the final pass.
+  bool recording = true;
+  /// @brief Samples a leaf must receive in the first pass before it is split.
+  unsigned split_threshold = 4000;
+  int max_depth = 24;
+
+  /// @brief Learned distribution at p, or nullptr if none is available yet.
+  const DirectionalDistribution* distribution(const Point3& p) const {
+    int leaf = find(p);
+    if (leaf < 0 || !leaves[leaf]->distribution.valid()) {
+      return nullptr;
+    }
+    return &leaves[leaf]->distribution;
+  }
+
+  /// @brief Adds a radiance estimate arriving at p from direction. Safe to
+  /// call from many threads at once.
+  void record(const Point3& p, const Vec3& direction, double value) {
+    if (!recording || !(value > 0) || !std::isfinite(value)) {
+      return;
+    }
+    int leaf = find(p);
+    if (leaf < 0) {
+      return;
+    }
+
+    auto& bin = leaves[leaf]->bins[DirectionalDistribution::bin_of(direction)];
+    float old = bin.load(std::memory_order_relaxed);
+    while (!bin.compare_exchange_weak(old, old + static_cast<float>(value),
+                                      std::memory_order_relaxed)) {
+    }
+    leaves[leaf]->samples.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// @brief Ends a learning pass. Must not run concurrently with rendering.
+  void refine() {
+    // The sample budget doubles every pass, so the split threshold grows with
+    // its square root as in the original SD-tree.
+    double threshold = split_threshold * std::sqrt(std::pow(2.0, iteration));
+    ++iteration;
+
+    size_t node_count = nodes.size();
+    for (size_t n = 0; n < node_count; ++n) {
+      if (nodes[n].child >= 0) {
+        continue;
+      }
+
+      GuideLeaf& leaf = *leaves[nodes[n].leaf];
+      float weights[DirectionalDistribution::bin_count];
+      for (int i = 0; i < DirectionalDistribution::bin_count; ++i) {
+        weights[i] = leaf.bins[i].load(std::memory_order_relaxed);
+      }
+
+      DirectionalDistribution learned;
+      learned.build(weights);
+      if (learned.valid()) {
+        leaf.distribution = learned;
+      }
+
+      unsigned samples = leaf.samples.load(std::memory_order_relaxed);
+      leaf.clear_bins();
+
+      if (samples > threshold && nodes[n].depth < max_depth) {
+        split(static_cast<int>(n));
+      }
+    }
+  }
+
+ public:
+  std::vector<Node> nodes;
+  std::vector<std::unique_ptr<GuideLeaf>> leaves;
+  int iteration = 0;
+
+ private:
+  int find(const Point3& p) const {
+    const AxisAlignedBoundingBox& root = nodes[0].box;
+    for (int a = 0; a < 3; ++a) {
+      if (p[a] < root.min()[a] || p[a] > root.max()[a]) {
+        return -1;
+      }
+    }
+
+    int n = 0;
+    while (nodes[n].child >= 0) {
+      int axis = nodes[n].depth % 3;
+      double mid = 0.5 * (nodes[n].box.min()[axis] + nodes[n].box.max()[axis]);
+      n = nodes[n].child + (p[axis] < mid ? 0 : 1);
+    }
+    return nodes[n].leaf;
+  }
+
+  void split(int n) {
+    Node parent = nodes[n];
+    int axis = parent.depth % 3;
+    double mid = 0.5 * (parent.box.min()[axis] + parent.box.max()[axis]);
+
+    Point3 lower_max = parent.box.max();
+    Point3 upper_min = parent.box.min();
+    lower_max[axis] = mid;
+    upper_min[axis] = mid;
+
+    // The parent's leaf slot is reused by the lower child; both children
+    // start from the parent's distribution.
+    int lower_leaf = parent.leaf;
+    int upper_leaf = static_cast<int>(leaves.size());
+    leaves.push_back(std::make_unique<GuideLeaf>());
+    leaves[upper_leaf]->distribution = leaves[lower_leaf]->distribution;
+
+    int child = static_cast<int>(nodes.size());
+    nodes.push_back({AxisAlignedBoundingBox(parent.box.min(), lower_max), -1,
+                     lower_leaf, parent.depth + 1});
+    nodes.push_back({AxisAlignedBoundingBox(upper_min, parent.box.max()), -1,
+                     upper_leaf, parent.depth + 1});
+
+    nodes[n].child = child;
+    nodes[n].leaf = -1;
+  }
+};
+
+#endif  // _RAY_TRACING_LIB_PATH_GUIDE_HPP_
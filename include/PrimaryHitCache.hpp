@@ -0,0 +1,172 @@
+#ifndef _RAY_TRACING_LIB_PRIMARY_HIT_CACHE_HPP_
+#define _RAY_TRACING_LIB_PRIMARY_HIT_CACHE_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FlatScene.hpp"
+#include "Hittable.hpp"
+#include "Ray.hpp"
+#include "common.hpp"
+
+/// @brief What the camera ray of every sample of an image hit first, so a
+/// render after an edit of materials, textures or lights can start shading
+/// without tracing camera rays through the BVH again.
+///
+/// An entry is 4 bytes: the index of the hit sphere of the FlatScene, or a
+/// mark for a ray that left the scene or hit something else. The hit point,
+/// normal, t and (u, v) follow from intersecting the camera ray with that
+/// one sphere, which gives exactly the record the full traversal gave. The
+/// camera ray itself is generated again from the sample's own seed, so a
+/// render from the cache equals one without.
+///
+/// Entries are per pixel and sample number, the sample count of the pixel
+/// before the sample was taken, so they fit any split into passes. The key
+/// identifies the geometry, camera, image size and seed they hold for.
+class PrimaryHitCache {
+ public:
+  static constexpr uint32_t kUnknown = UINT32_MAX;  // not traced yet
+  static constexpr uint32_t kMiss = UINT32_MAX - 1;  // left the scene
+  static constexpr uint32_t kOther = UINT32_MAX - 2;  // not a flat sphere
+
+  PrimaryHitCache(const FlatScene& spheres, int width, int height,
+                  unsigned samples_per_pixel, uint64_t key)
+      : spheres_(spheres),
+        width_(width),
+        height_(height),
+        samples_(samples_per_pixel),
+        key_(key),
+        entries_(static_cast<size_t>(width) * height * samples_per_pixel,
+                 kUnknown) {}
+
+  /// @brief Key for a render of the scene with spheres and shape_hash as in
+  /// Scene::shape_hash, seen by a camera with camera_hash, at the given
+  /// image size and accumulator seed.
+  static uint64_t key(const FlatScene& spheres, uint64_t shape_hash,
+                      uint64_t camera_hash, int width, int height,
+                      uint64_t seed) {
+    uint64_t key = mix_seed(spheres.shape_hash(), shape_hash);
+    key = mix_seed(key, camera_hash);
+    key = mix_seed(key, static_cast<uint64_t>(width) << 32 | height);
+    return mix_seed(key, seed);
+  }
+
+  /// @brief Closest hit of sample number sample of pixel (x, y), whose
+  /// camera ray is r, with world. Looked up when the sample was traced
+  /// before, traced and kept otherwise.
+  bool hit(int x, int y, unsigned sample, const Hittable& world, const Ray& r,
+           HitRecord& rec) {
+    if (sample >= samples_) {
+      return world.hit(r, 0.001, infinity, rec);
+    }
+    uint32_t& entry = entries_[index(x, y) * samples_ + sample];
+    if (entry == kMiss) {
+      return false;
+    }
+    if (entry != kUnknown && entry != kOther &&
+        spheres_.hit_sphere(entry, r, 0.001, infinity, rec)) {
+      return true;
+    }
+
+    bool hit = world.hit(r, 0.001, infinity, rec);
+    entry = !hit ? kMiss
+                 : rec.primitive == HitRecord::kNoPrimitive ? kOther
+                                                             : rec.primitive;
+    return hit;
+  }
+
+  /// @brief Writes the entries to file_name, next to it first and renamed
+  /// into place, like a checkpoint.
+  bool save(const std::string& file_name) const {
+    std::string temporary = file_name + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file) {
+        std::cerr << "Cannot write primary hits " << temporary << ".\n";
+        return false;
+      }
+      Header header{kMagic, kVersion, width_, height_, samples_, key_};
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(entries_.data()),
+                 entries_.size() * sizeof(uint32_t));
+      if (!file) {
+        std::cerr << "Failed writing primary hits " << temporary << ".\n";
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), file_name.c_str()) == 0;
+  }
+
+  /// @brief Takes the entries saved in file_name for as many samples as
+  /// both hold. Returns false, keeping none, if the file is missing or was
+  /// written for a different key.
+  bool load(const std::string& file_name) {
+    std::ifstream file(file_name, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+
+    Header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != kMagic || header.version != kVersion ||
+        header.width != width_ || header.height != height_ ||
+        header.key != key_) {
+      std::cerr << "Ignoring primary hits " << file_name
+                << ", the geometry or camera changed.\n";
+      return false;
+    }
+
+    if (header.samples > samples_per_pixel_limit) {
+      std::cerr << "Primary hits " << file_name << " are corrupt.\n";
+      return false;
+    }
+    const size_t saved_samples = header.samples;
+    std::vector<uint32_t> saved(static_cast<size_t>(width_) * height_ *
+                                saved_samples);
+    file.read(reinterpret_cast<char*>(saved.data()),
+              saved.size() * sizeof(uint32_t));
+    if (!file) {
+      std::cerr << "Primary hits " << file_name << " are truncated.\n";
+      return false;
+    }
+    const size_t kept = std::min<size_t>(samples_, saved_samples);
+    for (size_t p = 0; p < static_cast<size_t>(width_) * height_; ++p) {
+      std::copy(saved.begin() + p * saved_samples,
+                saved.begin() + p * saved_samples + kept,
+                entries_.begin() + p * samples_);
+    }
+    return true;
+  }
+
+ private:
+  static constexpr uint32_t kMagic = 0x43505452;  // "RTPC"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint64_t samples_per_pixel_limit = 1 << 20;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint64_t samples;
+    uint64_t key;
+  };
+
+  size_t index(int i, int j) const {
+    return static_cast<size_t>(i) + static_cast<size_t>(j) * width_;
+  }
+
+  const FlatScene& spheres_;
+  int width_;
+  int height_;
+  unsigned samples_;
+  uint64_t key_;
+  std::vector<uint32_t> entries_;
+};
+
+#endif  // _RAY_TRACING_LIB_PRIMARY_HIT_CACHE_HPP_
@@ -6,17 +6,28 @@
 class Ray {
  public:
   Ray() {}
-  Ray(const Point3& origin, const Vec3& direction)
-      : orig(origin), dir(direction) {}
+  Ray(const Point3& origin, const Vec3& direction, double time = 0.0)
+      : orig(origin), dir(direction), tm(time) {}
 
   Point3 origin() const { return orig; }
   Vec3 direction() const { return dir; }
+  double time() const { return tm; }
 
   Point3 at(double t) const { return orig + t * dir; }
 
+  /// @brief Width of the ray's cone at distance t.
+  double width_at(double t) const {
+    return width + spread * t * dir.length();
+  }
+
  public:
   Point3 orig;
   Vec3 dir;
+  double tm = 0;  // when the ray was sent, within the camera's shutter
+  // The ray stands for a cone, width wide at its origin and opening by
+  // spread per unit of distance, which sizes texture lookups.
+  double width = 0;
+  double spread = 0;
 };
 
 #endif
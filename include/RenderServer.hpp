@@ -0,0 +1,109 @@
+#ifndef _RAY_TRACING_LIB_RENDER_SERVER_HPP_
+#define _RAY_TRACING_LIB_RENDER_SERVER_HPP_
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Socket.hpp"
+
+/// @brief A render request: a scene file, settings that override the scene
+/// file's, and the image to write.
+struct RenderRequest {
+  std::string scene_file;
+  std::string output;  // image file name without extension
+  std::vector<std::string> settings;  // for SceneLoader::apply_setting
+};
+
+/// @brief Accepts render jobs on a socket and hands them to a handler one
+/// at a time.
+///
+/// Jobs are lines of text. A client sends any number of settings in scene
+/// file syntax, e.g. "camera 13 2 3  0 0 0  0 1 0  20 0.1" or
+/// "samples 64", followed by
+///
+///   render <scene file> <output>
+///
+/// and the server answers with one line, "done <seconds>" or
+/// "error <message>". A connection may send one job after another; settings
+/// only apply to the job they precede.
+class RenderServer {
+ public:
+  // A client that goes quiet in the middle of a job for this long is let go,
+  // so it can not hold up the others.
+  static constexpr int kReceiveTimeout = 60;  // seconds
+
+  bool listen(const std::string& address) {
+    return listener_.listen(address);
+  }
+
+  /// @brief Serves clients until the process ends, calling
+  /// handle(job, message) for every job. handle returns false and sets
+  /// message when the job fails.
+  template <typename Handle>
+  void serve(Handle handle) {
+    while (true) {
+      Connection client = listener_.accept();
+      if (!client.valid()) {
+        if (errno != EINTR) {
+          std::cerr << "accept failed: " << std::strerror(errno) << ".\n";
+        }
+        continue;
+      }
+      timeval timeout{kReceiveTimeout, 0};
+      ::setsockopt(client.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+      serve_client(client, handle);
+    }
+  }
+
+ private:
+  template <typename Handle>
+  static void serve_client(Connection& client, Handle handle) {
+    RenderRequest job;
+    std::string line;
+    while (client.receive_line(line)) {
+      std::istringstream words(line);
+      std::string keyword;
+      if (!(words >> keyword) || keyword[0] == '#') {
+        continue;
+      }
+      if (keyword != "render") {
+        job.settings.push_back(line);
+        continue;
+      }
+
+      std::string reply;
+      std::string extra;
+      if (!(words >> job.scene_file >> job.output) || (words >> extra)) {
+        reply = "error expected render <scene file> <output>";
+      } else {
+        std::string message;
+        auto start = std::chrono::steady_clock::now();
+        if (handle(job, message)) {
+          std::chrono::duration<double> seconds =
+              std::chrono::steady_clock::now() - start;
+          reply = "done " + std::to_string(seconds.count());
+        } else {
+          reply = "error " + message;
+        }
+      }
+      reply += '\n';
+      if (!client.send_all(reply.data(), reply.size())) {
+        return;
+      }
+      job = RenderRequest();
+    }
+  }
+
+  Listener listener_;
+};
+
+#endif  // _RAY_TRACING_LIB_RENDER_SERVER_HPP_
@@ -0,0 +1,496 @@
+#ifndef _RAY_TRACING_LIB_RENDERER_HPP_
+#define _RAY_TRACING_LIB_RENDERER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Accumulator.hpp"
+#include "Camera.hpp"
+#include "Integrator.hpp"
+#include "TileCosts.hpp"
+#include "TileWorld.hpp"
+#include "TraceStats.hpp"
+
+/// @brief Rectangle of pixels [x0, x1) x [y0, y1) of one pass of a job.
+struct RenderTile {
+  int x0, y0, x1, y1;
+  unsigned pass;  // counted from 0 for every job
+};
+
+/// @brief An image to render: what to render, the state to start from and
+/// where to stop.
+///
+/// Samples are added in passes of pass_samples until every pixel has
+/// samples_per_pixel. Starting from an accumulator that already holds
+/// samples, e.g. a loaded checkpoint or the result of a cancelled job,
+/// continues it exactly.
+struct RenderJob {
+  RenderJob(const RenderContext& context, const Camera& camera,
+            Accumulator accumulator)
+      : context(context), camera(camera), accumulator(std::move(accumulator)) {}
+
+  RenderContext context;  // must outlive the job
+  Camera camera;
+  Accumulator accumulator;  // image size, seed and the samples so far
+  int max_depth = 50;
+  unsigned samples_per_pixel = 32;
+  unsigned pass_samples = 4;
+  int tile_size = 32;
+  // Where to add up the time and rays every tile takes, if anywhere. Must
+  // outlive the job.
+  TileCosts* tile_costs = nullptr;
+
+  /// @brief Called on a render thread whenever a tile is done, with the
+  /// accumulator holding its samples. Calls for different tiles may overlap.
+  std::function<void(const RenderTile&, const Accumulator&)> on_tile;
+
+  /// @brief Called on a render thread after every pass, while no tile of the
+  /// job is being rendered, e.g. to save a checkpoint.
+  std::function<void(const Accumulator&)> on_pass;
+};
+
+/// @brief How far a job has come.
+struct RenderStats {
+  size_t tiles_done = 0;
+  size_t tiles_total = 0;  // over all passes
+  unsigned passes_done = 0;
+  unsigned passes_total = 0;
+  uint64_t samples = 0;  // camera samples taken
+  double seconds = 0;    // since the job started rendering
+  bool cancelled = false;
+  bool finished = false;
+
+  /// @brief Fraction of the job's tiles done.
+  double progress() const {
+    return tiles_total > 0 ? static_cast<double>(tiles_done) / tiles_total
+                           : finished;
+  }
+};
+
+/// @brief What one render thread did since the renderer started or its
+/// thread stats were reset.
+struct ThreadStats {
+  double busy_seconds = 0;  // rendering tiles, callbacks included
+  size_t tiles = 0;
+  std::chrono::steady_clock::time_point last_tile;  // when the last ended
+};
+
+class Renderer;
+
+/// @brief A job submitted to a Renderer. The future becomes ready with the
+/// job's accumulator once the job is finished or cancelled.
+class RenderHandle {
+ public:
+  RenderHandle() {}
+
+  bool valid() const { return state_ != nullptr; }
+
+  std::future<Accumulator>& future() { return future_; }
+
+  /// @brief Waits for the job and returns its accumulator.
+  Accumulator get() { return future_.get(); }
+
+  /// @brief Waits up to timeout; true once the job is over.
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    return future_.wait_for(timeout) == std::future_status::ready;
+  }
+
+  /// @brief Stops the job as soon as possible: a queued job never starts,
+  /// a running one stops after the rows being rendered. Everything finished
+  /// so far stays in the accumulator, with the sample count of every pixel,
+  /// so submitting it again later picks up where it stopped.
+  void cancel() {
+    if (state_) {
+      state_->cancelled = true;
+    }
+  }
+
+  RenderStats stats() const;
+
+ private:
+  friend class Renderer;
+
+  struct State {
+    explicit State(RenderJob job) : job(std::move(job)) {}
+
+    RenderJob job;
+    std::promise<Accumulator> promise;
+    std::atomic<bool> cancelled{false};
+
+    // Touched only by the thread that plans the passes of the job's batch.
+    bool in_pass = false;  // has tiles in the current pass
+    bool done = false;     // handed back
+
+    mutable std::mutex stats_mutex;
+    bool started = false;
+    RenderStats stats;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  RenderHandle(std::shared_ptr<State> state)
+      : state_(std::move(state)), future_(state_->promise.get_future()) {}
+
+  std::shared_ptr<State> state_;
+  std::future<Accumulator> future_;
+};
+
+inline RenderStats RenderHandle::stats() const {
+  RenderStats stats;
+  if (state_) {
+    std::lock_guard<std::mutex> lock(state_->stats_mutex);
+    stats = state_->stats;
+    if (state_->started && !stats.finished) {
+      stats.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - state_->start)
+                          .count();
+    }
+  }
+  return stats;
+}
+
+/// @brief Renders jobs on a pool of threads that stays up between them.
+///
+/// Jobs run one batch after the other in the order they were submitted,
+/// each batch with all threads. A pass of a batch holds the tiles of the
+/// next pass of every unfinished job in it, interleaved, which the threads
+/// take one at a time; the next pass starts once all tiles of a pass are
+/// in. Every pixel's samples are seeded from its own sample count, so the
+/// image does not depend on the number of threads, on the other jobs of the
+/// batch or on where a job was cancelled and resumed.
+class Renderer {
+ public:
+  explicit Renderer(int num_threads =
+                        std::max(1u, std::thread::hardware_concurrency()))
+      : thread_stats_(std::max(1, num_threads)) {
+    for (int t = 0; t < std::max(1, num_threads); ++t) {
+      threads_.emplace_back([this, t]() { run(t); });
+    }
+  }
+
+  Renderer(const Renderer&) = delete;
+  Renderer& operator=(const Renderer&) = delete;
+
+  /// @brief Cancels the jobs that are not done yet and waits for them.
+  ~Renderer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      for (const auto& batch : queue_) {
+        for (const auto& state : batch->jobs) {
+          state->cancelled = true;
+        }
+      }
+    }
+    work_ready_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  int thread_count() const { return static_cast<int>(threads_.size()); }
+
+  /// @brief Work of every thread so far, e.g. to see how evenly a job was
+  /// spread over them.
+  std::vector<ThreadStats> thread_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return thread_stats_;
+  }
+
+  /// @brief Starts the thread stats over, best while no job runs.
+  void reset_thread_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fill(thread_stats_.begin(), thread_stats_.end(), ThreadStats());
+  }
+
+  /// @brief Queues job behind the jobs submitted before it.
+  RenderHandle submit(RenderJob job) {
+    std::vector<RenderJob> jobs;
+    jobs.push_back(std::move(job));
+    return std::move(submit(std::move(jobs)).front());
+  }
+
+  /// @brief Queues jobs as one batch, e.g. several views of a scene, whose
+  /// tiles are rendered side by side. Returns their handles in order.
+  std::vector<RenderHandle> submit(std::vector<RenderJob> jobs) {
+    auto batch = std::make_shared<Batch>();
+    std::vector<RenderHandle> handles;
+    for (RenderJob& job : jobs) {
+      batch->jobs.push_back(std::make_shared<State>(std::move(job)));
+      handles.push_back(RenderHandle(batch->jobs.back()));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(batch));
+    }
+    work_ready_.notify_all();
+    return handles;
+  }
+
+ private:
+  using State = RenderHandle::State;
+
+  struct Batch {
+    std::vector<std::shared_ptr<State>> jobs;  // the unfinished ones
+    // Guarded by the renderer's mutex.
+    std::vector<std::pair<State*, RenderTile>> tiles;  // of the current pass
+    size_t next_tile = 0;
+    size_t running = 0;  // tiles being rendered, or the pass being planned
+  };
+
+  void run(int thread) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      drop_cancelled();
+      if (queue_.empty()) {
+        if (stopping_) {
+          return;
+        }
+        work_ready_.wait(lock);
+        continue;
+      }
+
+      std::shared_ptr<Batch> batch = queue_.front();
+      Batch& b = *batch;
+      if (b.running == 0 && b.next_tile == b.tiles.size()) {
+        // Between passes. Counted as running, so no other thread starts a
+        // tile or plans the pass meanwhile.
+        b.running = 1;
+        lock.unlock();
+        std::vector<std::pair<State*, RenderTile>> tiles = next_pass(b);
+        lock.lock();
+        b.tiles = std::move(tiles);
+        b.next_tile = 0;
+        b.running = 0;
+        b.jobs.erase(std::remove_if(b.jobs.begin(), b.jobs.end(),
+                                    [](const std::shared_ptr<State>& state) {
+                                      return state->done;
+                                    }),
+                     b.jobs.end());
+        if (b.jobs.empty()) {
+          queue_.pop_front();
+        }
+        work_ready_.notify_all();
+        continue;
+      }
+      if (b.next_tile == b.tiles.size()) {
+        // Nothing left to start; wait for the tiles being rendered.
+        work_ready_.wait(lock);
+        continue;
+      }
+
+      auto [state, tile] = b.tiles[b.next_tile++];
+      if (state->cancelled) {
+        continue;
+      }
+      ++b.running;
+      lock.unlock();
+      auto start = std::chrono::steady_clock::now();
+      if (render_tile(*state, tile) && state->job.on_tile) {
+        state->job.on_tile(tile, state->job.accumulator);
+      }
+      auto end = std::chrono::steady_clock::now();
+      lock.lock();
+      ThreadStats& stats = thread_stats_[thread];
+      stats.busy_seconds += std::chrono::duration<double>(end - start).count();
+      ++stats.tiles;
+      stats.last_tile = end;
+      if (--b.running == 0) {
+        work_ready_.notify_all();
+      }
+    }
+  }
+
+  // Closes the pass of b that just ended, hands back the jobs that are done
+  // or cancelled, and returns the tiles of the next pass of the others. Runs
+  // without the lock, so it leaves b.jobs as it is.
+  std::vector<std::pair<State*, RenderTile>> next_pass(Batch& b) {
+    for (const auto& state : b.jobs) {
+      State& s = *state;
+      if (s.in_pass && !s.cancelled) {
+        if (s.job.on_pass) {
+          s.job.on_pass(s.job.accumulator);
+        }
+        std::lock_guard<std::mutex> stats_lock(s.stats_mutex);
+        ++s.stats.passes_done;
+      }
+      s.in_pass = false;
+    }
+
+    std::vector<State*> planned;
+    std::vector<std::vector<RenderTile>> job_tiles;
+    for (const auto& state : b.jobs) {
+      std::vector<RenderTile> tiles = plan_pass(*state);
+      if (tiles.empty()) {
+        finish(*state);
+      } else {
+        planned.push_back(state.get());
+        job_tiles.push_back(std::move(tiles));
+      }
+    }
+
+    std::vector<std::pair<State*, RenderTile>> tiles;
+    for (size_t k = 0, added = 1; added > 0; ++k) {
+      added = 0;
+      for (size_t j = 0; j < planned.size(); ++j) {
+        if (k < job_tiles[j].size()) {
+          tiles.emplace_back(planned[j], job_tiles[j][k]);
+          ++added;
+        }
+      }
+    }
+    return tiles;
+  }
+
+  // Tiles of the next pass of s; none when the job is over.
+  static std::vector<RenderTile> plan_pass(State& s) {
+    Accumulator& accumulator = s.job.accumulator;
+    const RenderJob& job = s.job;
+    unsigned taken = accumulator.min_samples();
+    unsigned spp = std::max(1u, job.pass_samples);
+    std::vector<RenderTile> tiles;
+    if (s.cancelled || taken >= job.samples_per_pixel ||
+        accumulator.pixel_count() == 0) {
+      return tiles;
+    }
+
+    const int size = std::max(1, job.tile_size);
+    const int width = accumulator.width();
+    const int height = accumulator.height();
+    if (job.tile_costs) {
+      job.tile_costs->fit(width, height, size);
+    }
+    for (int y = 0; y < height; y += size) {
+      for (int x = 0; x < width; x += size) {
+        tiles.push_back(RenderTile{x, y, std::min(x + size, width),
+                                   std::min(y + size, height), 0});
+      }
+    }
+
+    std::lock_guard<std::mutex> stats_lock(s.stats_mutex);
+    if (!s.started) {
+      s.started = true;
+      s.start = std::chrono::steady_clock::now();
+      // The fewest samples grow by spp every pass.
+      s.stats.passes_total = (job.samples_per_pixel - taken + spp - 1) / spp;
+      s.stats.tiles_total = tiles.size() * s.stats.passes_total;
+    }
+    for (RenderTile& tile : tiles) {
+      tile.pass = s.stats.passes_done;
+    }
+    s.in_pass = true;
+    return tiles;
+  }
+
+  // Adds the pass's samples to the pixels of tile. Stops between rows once
+  // the job is cancelled; false if it did.
+  static bool render_tile(State& s, const RenderTile& tile) {
+    const RenderJob& job = s.job;
+    Accumulator& accumulator = s.job.accumulator;
+    unsigned spp = std::max(1u, job.pass_samples);
+    uint64_t samples = 0;
+    bool complete = true;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t rays = traced_rays();
+
+    // Camera rays only see the part of the world in the tile's frustum.
+    TileWorld tile_world(
+        job.context.world,
+        tile_frustum(job.camera, tile.x0, tile.y0, tile.x1, tile.y1,
+                     accumulator.width(), accumulator.height()));
+    RenderContext context = job.context;
+    context.camera_world = &tile_world;
+
+    for (int j = tile.y0; j < tile.y1; ++j) {
+      if (s.cancelled) {
+        complete = false;
+        break;
+      }
+      for (int i = tile.x0; i < tile.x1; ++i) {
+        unsigned count =
+            pass_count(accumulator.samples(i, j), spp, job.samples_per_pixel);
+
+        Color pixel_color(0, 0, 0);
+        PixelFeatures pixel_features;
+        double luminance_squared = 0;
+        take_samples(i, j, count, job.camera, context,
+                     accumulator.width(), accumulator.height(), job.max_depth,
+                     accumulator.seed(), accumulator.samples(i, j),
+                     pixel_color, luminance_squared, pixel_features);
+        accumulator.add(i, j, pixel_color, luminance_squared, pixel_features,
+                        count);
+        samples += count;
+      }
+    }
+
+    if (job.tile_costs) {
+      job.tile_costs->add(
+          tile.x0, tile.y0,
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+              .count(),
+          samples, traced_rays() - rays);
+    }
+
+    std::lock_guard<std::mutex> stats_lock(s.stats_mutex);
+    s.stats.samples += samples;
+    s.stats.tiles_done += complete;
+    return complete;
+  }
+
+  // Hands the job its accumulator back.
+  static void finish(State& s) {
+    {
+      std::lock_guard<std::mutex> stats_lock(s.stats_mutex);
+      if (s.started) {
+        s.stats.seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - s.start)
+                              .count();
+      }
+      s.stats.cancelled = s.cancelled;
+      s.stats.finished = true;
+    }
+    s.done = true;
+    s.promise.set_value(std::move(s.job.accumulator));
+  }
+
+  // Ends the jobs that were cancelled before their batch started, so their
+  // futures do not wait for the batches ahead of them.
+  void drop_cancelled() {
+    for (size_t i = 1; i < queue_.size();) {
+      auto& jobs = queue_[i]->jobs;
+      for (auto it = jobs.begin(); it != jobs.end();) {
+        if ((*it)->cancelled) {
+          finish(**it);
+          it = jobs.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      if (jobs.empty()) {
+        queue_.erase(queue_.begin() + i);
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::deque<std::shared_ptr<Batch>> queue_;  // the front one is rendering
+  bool stopping_ = false;
+  std::vector<ThreadStats> thread_stats_;  // guarded by mutex_
+  std::vector<std::thread> threads_;
+};
+
+#endif  // _RAY_TRACING_LIB_RENDERER_HPP_
@@ -0,0 +1,1054 @@
+#ifndef _RAY_TRACING_LIB_SCENE_FILE_HPP_
+#define _RAY_TRACING_LIB_SCENE_FILE_HPP_
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Bvh.hpp"
+#include "Camera.hpp"
+#include "HittableList.hpp"
+#include "ImageTexture.hpp"
+#include "Material.hpp"
+#include "MotionBvh.hpp"
+#include "MovingSphere.hpp"
+#include "ObjLoader.hpp"
+#include "Sphere.hpp"
+#include "SphereStore.hpp"
+#include "Texture.hpp"
+#include "TriangleMesh.hpp"
+#include "common.hpp"
+
+/// @brief Size and modification time of file_name, hashed, or 0 if it is
+/// missing. Changes when the file is written, without reading it.
+inline uint64_t file_stamp(const std::string& file_name) {
+  struct stat info;
+  if (::stat(file_name.c_str(), &info) != 0) {
+    return 0;
+  }
+  return mix_seed(static_cast<uint64_t>(info.st_size),
+                  static_cast<uint64_t>(info.st_mtime));
+}
+
+/// @brief One of several named cameras of a scene, each with its own image
+/// size. The shutter, samples and depth are the scene's.
+struct View {
+  std::string name;
+  int image_width = 400;
+  int image_height = 225;
+  Point3 look_from = Point3(0, 0, 1);
+  Point3 look_at = Point3(0, 0, 0);
+  Vec3 up = Vec3(0, 1, 0);
+  double vfov = 40;
+  double aperture = 0;
+  double focus_distance = 0;  // 0 focuses on look_at
+
+  double aspect_ratio() const {
+    return static_cast<double>(image_width) / image_height;
+  }
+
+  Camera camera(double shutter_open, double shutter_close) const {
+    double focus = focus_distance > 0 ? focus_distance
+                                      : (look_from - look_at).length();
+    return Camera(look_from, look_at, up, vfov, aspect_ratio(), aperture,
+                  focus, shutter_open, shutter_close);
+  }
+};
+
+/// @brief Everything needed to render a scene: render settings, camera,
+/// background and objects.
+struct Scene {
+  std::string name;
+
+  // Render settings
+  int image_width = 400;
+  int image_height = 225;
+  unsigned samples_per_pixel = 32;
+  int max_depth = 50;
+
+  // Camera. A focus distance of 0 focuses on look_at.
+  Point3 look_from = Point3(0, 0, 1);
+  Point3 look_at = Point3(0, 0, 0);
+  Vec3 up = Vec3(0, 1, 0);
+  double vfov = 40;
+  double aperture = 0;
+  double focus_distance = 0;
+  // Within the frame, which runs from time 0 to 1. Equal times give no
+  // motion blur.
+  double shutter_open = 0;
+  double shutter_close = 0;
+
+  // Further cameras. A scene with views renders each of them instead of
+  // the camera above.
+  std::vector<View> views;
+
+  // Background: an equirectangular map if environment_file is set, else a
+  // constant color.
+  Color background = Color(0, 0, 0);
+  std::string environment_file;
+  double environment_intensity = 1.0;
+
+  HittableList objects;  // one BVH over every primitive
+  HittableList lights;   // the emissive spheres, for light sampling
+  SphereStore spheres;
+  std::vector<shared_ptr<Hittable>> meshes;
+  shared_ptr<Hittable> moving;  // a MotionBvh over the moving spheres
+  size_t primitive_count = 0;
+  size_t material_count = 0;  // distinct materials after deduplication
+
+  // Hash of the sphere, material and texture statements, independent of
+  // their order and spacing. Identifies cached spheres.
+  uint64_t geometry_hash = 0;
+  // Hash of the shapes of the meshes and moving spheres, without their
+  // materials. With FlatScene::shape_hash() it identifies the geometry.
+  uint64_t shape_hash = 0;
+  // Hash of every statement but those describing the camera, the image size
+  // and the sample count, of the mesh files' contents and of the
+  // file_stamp() of the image and environment files. With the camera it
+  // identifies the image a checkpoint holds samples of.
+  uint64_t content_hash = 0;
+  // The mesh, image texture and environment files the scene reads.
+  std::vector<std::string> files;
+
+  double aspect_ratio() const {
+    return static_cast<double>(image_width) / image_height;
+  }
+
+  double focus() const {
+    return focus_distance > 0 ? focus_distance : (look_from - look_at).length();
+  }
+
+  Camera camera() const {
+    return Camera(look_from, look_at, up, vfov, aspect_ratio(), aperture,
+                  focus(), shutter_open, shutter_close);
+  }
+
+  /// @brief The camera and image size as a view called name.
+  View view(const std::string& name) const {
+    return View{name, image_width, image_height, look_from, look_at, up,
+                vfov, aperture, focus_distance};
+  }
+};
+
+/// @brief Reads scene description files.
+///
+/// The format is line based; '#' starts a comment and a name is any token
+/// that is not a number.
+///
+///   image <width> <height>
+///   samples <samples per pixel>
+///   depth <max depth>
+///   camera <from x y z> <at x y z> <up x y z> <vfov> <aperture> [<focus>]
+///   shutter <open time> <close time>
+///   view <name> <width> <height> <from> <at> <up> <vfov> <aperture> [<focus>]
+///   turntable <count>
+///   stereo <eye distance>
+///   background <r g b>
+///   environment <file.hdr> [<intensity>]
+///   texture <name> solid <r g b>
+///   texture <name> checker <r g b> <r g b>
+///   texture <name> checker <even texture> <odd texture>
+///   texture <name> image <file>
+///   material <name> <material>
+///   sphere <x y z> <radius> <material name | material>
+///   sphere_field <count> [<seed>]
+///   mesh <file.obj> <x y z> <scale> <material name | material>
+///   moving_sphere <radius> <x y z> <x y z> [<x y z>...] <material>
+///
+/// where <material> is one of
+///
+///   lambertian <r g b> | lambertian <texture>
+///   metal <r g b> <fuzz>
+///   dielectric <index of refraction>
+///   light <r g b>
+///
+/// Names may be used before they are defined. Materials with identical
+/// parameters share one instance, whether they are named or written inline.
+/// Mesh and image files are relative to the scene file, and a file used
+/// several times is loaded once. The centers of a moving sphere are
+/// keyframes spread evenly over the frame, from time 0 to 1. A sphere
+/// field is generate_sphere_field()'s procedural field of count small
+/// spheres on the plane y = 0.
+///
+/// turntable adds count views, turn_000 and on, that circle the camera
+/// around look_at about the y axis; stereo adds a left and a right view
+/// eye distance apart. Both start from the image size and camera set so
+/// far.
+///
+/// Files are read in one piece and the lines are parsed in parallel, one
+/// chunk per thread. Spheres, which make up nearly every line of a large
+/// scene, are decoded into compact records in that pass; the few other
+/// statements run in order afterwards.
+class SceneLoader {
+ public:
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  /// @brief When false, spheres are only hashed, e.g. when they come from a
+  /// cache. Meshes are always loaded.
+  bool load_geometry = true;
+  /// @brief Builds a BvhNode over the spheres and meshes into
+  /// Scene::objects. Otherwise the spheres are only kept in Scene::spheres.
+  bool build_bvh = true;
+
+  /// @brief Loads file_name into scene. Problems are reported on std::cerr
+  /// with their line number and make the load fail.
+  bool load(const std::string& file_name, Scene& scene) const {
+    std::ifstream file(file_name, std::ios::binary);
+    if (!file) {
+      std::cerr << "Cannot open scene " << file_name << ".\n";
+      return false;
+    }
+    file.seekg(0, std::ios::end);
+    std::string text(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(text.data(), text.size());
+
+    scene.name = stem(file_name);
+    // Settings are overwritten by the file, views and shapes are added up.
+    scene.views.clear();
+    scene.shape_hash = 0;
+    scene.files.clear();
+
+    // Parse chunks of whole lines in parallel.
+    std::vector<Chunk> chunks = split(text);
+    std::vector<std::thread> threads;
+    for (size_t c = 1; c < chunks.size(); ++c) {
+      threads.emplace_back([&, c]() { parse(text, chunks[c]); });
+    }
+    parse(text, chunks[0]);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    scene.geometry_hash = 0;
+    scene.content_hash = 0;
+    for (const Chunk& chunk : chunks) {
+      scene.geometry_hash += chunk.geometry_hash;
+      scene.content_hash += chunk.content_hash;
+    }
+
+    // Line numbers are only known once every chunk has counted its lines.
+    size_t first_line = 1;
+    for (Chunk& chunk : chunks) {
+      chunk.first_line = first_line;
+      first_line += chunk.line_count;
+    }
+
+    bool ok = true;
+    for (const Chunk& chunk : chunks) {
+      for (const Error& error : chunk.errors) {
+        report(file_name, chunk.first_line + error.line, error.message);
+        ok = false;
+      }
+    }
+
+    Definitions definitions;
+    definitions.directory = directory(file_name);
+    for (const Chunk& chunk : chunks) {
+      for (const Statement& statement : chunk.statements) {
+        std::string message;
+        if (!apply(statement.tokens, chunk.first_line + statement.line, scene,
+                   definitions, message)) {
+          report(file_name, chunk.first_line + statement.line, message);
+          ok = false;
+        }
+      }
+    }
+    if (!ok) {
+      return false;
+    }
+
+    // Images are large, so they count by size and modification time, as
+    // TextureCache keys its tiles, rather than by their contents.
+    for (const auto& texture : definitions.textures) {
+      if (texture.second.type == "image") {
+        scene.files.push_back(
+            relative_to(definitions.directory, texture.second.file));
+        scene.content_hash += file_stamp(scene.files.back());
+      }
+    }
+    if (!scene.environment_file.empty()) {
+      scene.files.push_back(scene.environment_file);
+      scene.content_hash += file_stamp(scene.environment_file);
+    }
+
+    Materials materials;
+    scene.objects.clear();
+    scene.spheres = SphereStore();
+    if (load_geometry &&
+        !build(file_name, chunks, definitions, materials, scene)) {
+      return false;
+    }
+    if (!build_meshes(file_name, definitions, materials, scene) ||
+        !build_moving(file_name, definitions, materials, scene)) {
+      return false;
+    }
+
+    if (build_bvh) {
+      std::vector<shared_ptr<Hittable>> objects;
+      for (size_t i = 0; i < scene.spheres.size(); ++i) {
+        objects.push_back(scene.spheres.object(i));
+      }
+      objects.insert(objects.end(), scene.meshes.begin(), scene.meshes.end());
+      if (scene.moving) {
+        objects.push_back(scene.moving);
+      }
+      if (!objects.empty()) {
+        scene.objects.add(make_shared<BvhNode>(objects, 0, objects.size()));
+      }
+    }
+    return true;
+  }
+
+  /// @brief Applies one render setting statement (image, samples, depth,
+  /// camera, shutter or background) to scene, e.g. to render a loaded scene
+  /// differently. Anything else is refused with a message.
+  static bool apply_setting(const std::string& line, Scene& scene,
+                            std::string& message) {
+    Tokens tokens;
+    tokenize(line, tokens);
+    static const char* const settings[] = {"image",  "samples", "depth",
+                                           "camera", "shutter", "background"};
+    bool setting = false;
+    for (const char* keyword : settings) {
+      setting |= !tokens.empty() && tokens[0] == keyword;
+    }
+    if (!setting) {
+      message = tokens.empty() ? "empty setting"
+                               : "'" + std::string(tokens[0]) +
+                                     "' is not a render setting";
+      return false;
+    }
+    Definitions unused;
+    return apply(tokens, 0, scene, unused, message);
+  }
+
+ private:
+  using Tokens = std::vector<std::string_view>;
+
+  struct MaterialSpec {
+    std::string type;
+    Color color;
+    double parameter = 0;  // fuzz or index of refraction
+    std::string texture;   // lambertian with a named texture
+
+    // Identical specs give identical keys, which is what deduplicates them.
+    std::string key() const {
+      char numbers[128];
+      snprintf(numbers, sizeof(numbers), " %.17g %.17g %.17g %.17g",
+               color.x(), color.y(), color.z(), parameter);
+      return type + numbers + (texture.empty() ? "" : " @" + texture);
+    }
+  };
+
+  struct TextureSpec {
+    std::string type;
+    Color even;
+    Color odd;
+    std::string even_name;  // checker of named textures
+    std::string odd_name;
+    std::string file;  // image
+  };
+
+  struct SphereRecord {
+    Point3 center;
+    double radius;
+    unsigned material;  // index into the chunk's material references
+  };
+
+  // A material as written on sphere lines: a name, or an inline spec.
+  struct MaterialReference {
+    std::string name;
+    MaterialSpec spec;
+    size_t line;  // first use, for error messages
+  };
+
+  struct MeshSpec {
+    std::string file;
+    Vec3 offset;
+    double scale;
+    MaterialReference material;
+  };
+
+  struct MovingSpec {
+    std::vector<Point3> centers;
+    double radius;
+    MaterialReference material;
+  };
+
+  struct FieldSpec {
+    size_t count;
+    uint64_t seed;
+  };
+
+  struct Statement {
+    size_t line;  // relative to the chunk
+    Tokens tokens;
+  };
+
+  struct Error {
+    size_t line;
+    std::string message;
+  };
+
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    size_t first_line = 1;
+    size_t line_count = 0;
+    uint64_t geometry_hash = 0;
+    uint64_t content_hash = 0;
+    std::vector<SphereRecord> spheres;
+    std::vector<MaterialReference> materials;
+    // Keyed by the material's text on the sphere line, which points into the
+    // loaded file, so repeated materials cost one lookup and no parsing.
+    std::unordered_map<std::string_view, unsigned> material_index;
+    std::vector<Statement> statements;
+    std::vector<Error> errors;
+
+  };
+
+  struct Definitions {
+    std::string directory;  // of the scene file, for relative paths
+    std::map<std::string, TextureSpec> textures;
+    std::map<std::string, MaterialSpec> materials;
+    std::vector<MeshSpec> meshes;
+    std::vector<MovingSpec> moving;
+    std::vector<FieldSpec> fields;
+  };
+
+  // Materials made so far, deduplicated by MaterialSpec::key().
+  struct Materials {
+    std::unordered_map<std::string, shared_ptr<Material>> by_key;
+    std::map<std::string, shared_ptr<Texture>> textures;
+  };
+
+  static void report(const std::string& file_name, size_t line,
+                     const std::string& message) {
+    std::cerr << file_name << ':' << line << ": " << message << '\n';
+  }
+
+  static std::string directory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+  }
+
+  static std::string relative_to(const std::string& directory,
+                                 const std::string& path) {
+    return path.front() == '/' ? path : directory + path;
+  }
+
+  static std::string stem(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string base =
+        slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = base.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? base : base.substr(0, dot);
+  }
+
+  std::vector<Chunk> split(const std::string& text) const {
+    // Small files are not worth the threads.
+    size_t count = std::min<size_t>(num_threads, text.size() / (1 << 16) + 1);
+    size_t size = text.size() / count + 1;
+
+    std::vector<Chunk> chunks;
+    size_t begin = 0;
+    while (begin < text.size() || chunks.empty()) {
+      size_t end = std::min(begin + size, text.size());
+      while (end < text.size() && text[end - 1] != '\n') {
+        ++end;
+      }
+      chunks.push_back({begin, end});
+      begin = end;
+    }
+    return chunks;
+  }
+
+  // Splits line into tokens, reusing the storage of tokens.
+  static void tokenize(std::string_view line, Tokens& tokens) {
+    auto space = [&](size_t i) {
+      return std::isspace(static_cast<unsigned char>(line[i])) != 0;
+    };
+
+    tokens.clear();
+    size_t i = 0;
+    while (i < line.size()) {
+      while (i < line.size() && space(i)) {
+        ++i;
+      }
+      if (i >= line.size() || line[i] == '#') {
+        break;
+      }
+      size_t start = i;
+      while (i < line.size() && !space(i)) {
+        ++i;
+      }
+      tokens.push_back(line.substr(start, i - start));
+    }
+  }
+
+  // Tokens point into the loaded text, so a number always ends at whitespace
+  // or at the terminating null of the string.
+  static bool number(std::string_view token, double& value) {
+    char* end;
+    value = std::strtod(token.data(), &end);
+    return end == token.data() + token.size();
+  }
+
+  static bool numbers(const Tokens& tokens, size_t first, size_t count,
+                      double* values) {
+    if (first + count > tokens.size()) {
+      return false;
+    }
+    for (size_t k = 0; k < count; ++k) {
+      if (!number(tokens[first + k], values[k])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool vector(const Tokens& tokens, size_t first, Vec3& v) {
+    double values[3];
+    if (!numbers(tokens, first, 3, values)) {
+      return false;
+    }
+    v = Vec3(values[0], values[1], values[2]);
+    return true;
+  }
+
+  // Parses the material starting at tokens[first], which must use up the
+  // rest of the line.
+  static bool material(const Tokens& tokens, size_t first, MaterialSpec& spec,
+                       std::string& message) {
+    if (first >= tokens.size()) {
+      message = "missing material";
+      return false;
+    }
+    spec.type = std::string(tokens[first]);
+    size_t count = tokens.size() - first - 1;
+
+    bool ok = false;
+    if (spec.type == "lambertian") {
+      double unused;
+      if (count == 1 && !number(tokens[first + 1], unused)) {
+        spec.texture = std::string(tokens[first + 1]);
+        ok = true;
+      } else {
+        ok = count == 3 && vector(tokens, first + 1, spec.color);
+      }
+    } else if (spec.type == "metal") {
+      ok = count == 4 && vector(tokens, first + 1, spec.color) &&
+           number(tokens[first + 4], spec.parameter);
+    } else if (spec.type == "dielectric") {
+      ok = count == 1 && number(tokens[first + 1], spec.parameter);
+    } else if (spec.type == "light") {
+      ok = count == 3 && vector(tokens, first + 1, spec.color);
+    } else {
+      message = "unknown material type '" + spec.type + "'";
+      return false;
+    }
+
+    if (!ok) {
+      message = "bad parameters for " + spec.type;
+    }
+    return ok;
+  }
+
+  // Hashes the tokens of a line. Lines are combined by addition, so the
+  // result does not depend on their order or on how the file was chunked.
+  static uint64_t line_hash(const Tokens& tokens) {
+    uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a
+    for (std::string_view token : tokens) {
+      for (char c : token) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+      }
+      hash = (hash ^ ' ') * 0x100000001b3ull;
+    }
+    return mix_seed(hash, 0);
+  }
+
+  // Statements covered by Camera::hash(), the image size or the sample
+  // count. Leaving samples out lets a finished image be extended.
+  static bool camera_statement(std::string_view keyword) {
+    return keyword == "image" || keyword == "samples" ||
+           keyword == "camera" || keyword == "shutter" || keyword == "view" ||
+           keyword == "turntable" || keyword == "stereo";
+  }
+
+  void parse(const std::string& text, Chunk& chunk) const {
+    Tokens tokens;
+    size_t line = 0;
+    size_t begin = chunk.begin;
+    while (begin < chunk.end) {
+      size_t end = text.find('\n', begin);
+      end = end == std::string::npos || end > chunk.end ? chunk.end : end;
+      tokenize(std::string_view(text.data() + begin, end - begin), tokens);
+      begin = end + 1;
+
+      bool sphere_line = !tokens.empty() && tokens[0] == "sphere";
+      if (sphere_line ||
+          (!tokens.empty() &&
+           (tokens[0] == "material" || tokens[0] == "texture" ||
+            tokens[0] == "sphere_field"))) {
+        chunk.geometry_hash += line_hash(tokens);
+      }
+      if (!tokens.empty() && !camera_statement(tokens[0])) {
+        chunk.content_hash += line_hash(tokens);
+      }
+
+      if (sphere_line && !load_geometry) {
+        // Only the hash is needed.
+      } else if (sphere_line) {
+        SphereRecord sphere;
+        if (tokens.size() < 6 || !vector(tokens, 1, sphere.center) ||
+            !number(tokens[4], sphere.radius)) {
+          chunk.errors.push_back({line, "expected sphere <x y z> <radius>"});
+          ++line;
+          continue;
+        }
+
+        std::string_view text_of_material(
+            tokens[5].data(),
+            tokens.back().data() + tokens.back().size() - tokens[5].data());
+        auto [it, added] = chunk.material_index.emplace(
+            text_of_material, static_cast<unsigned>(chunk.materials.size()));
+        if (added) {
+          MaterialReference reference{std::string(), MaterialSpec(), line};
+          std::string message;
+          if (tokens.size() == 6) {
+            reference.name = std::string(tokens[5]);
+          } else if (!material(tokens, 5, reference.spec, message)) {
+            chunk.errors.push_back({line, message});
+          }
+          chunk.materials.push_back(reference);
+        }
+        sphere.material = it->second;
+        chunk.spheres.push_back(sphere);
+      } else if (!tokens.empty()) {
+        chunk.statements.push_back({line, tokens});
+      }
+      ++line;
+    }
+    chunk.line_count = line;
+  }
+
+  // Runs a statement other than sphere.
+  static bool apply(const Tokens& tokens, size_t line, Scene& scene,
+                    Definitions& definitions, std::string& message) {
+    const std::string_view keyword = tokens[0];
+    double values[14];
+
+    if (keyword == "image") {
+      if (tokens.size() != 3 || !numbers(tokens, 1, 2, values) ||
+          values[0] < 1 || values[1] < 1) {
+        message = "expected image <width> <height>";
+        return false;
+      }
+      scene.image_width = static_cast<int>(values[0]);
+      scene.image_height = static_cast<int>(values[1]);
+    } else if (keyword == "samples") {
+      if (tokens.size() != 2 || !numbers(tokens, 1, 1, values) ||
+          values[0] < 1) {
+        message = "expected samples <samples per pixel>";
+        return false;
+      }
+      scene.samples_per_pixel = static_cast<unsigned>(values[0]);
+    } else if (keyword == "depth") {
+      if (tokens.size() != 2 || !numbers(tokens, 1, 1, values)) {
+        message = "expected depth <max depth>";
+        return false;
+      }
+      scene.max_depth = static_cast<int>(values[0]);
+    } else if (keyword == "camera") {
+      size_t count = tokens.size() - 1;
+      if ((count != 11 && count != 12) ||
+          !numbers(tokens, 1, count, values)) {
+        message =
+            "expected camera <from> <at> <up> <vfov> <aperture> [<focus>]";
+        return false;
+      }
+      scene.look_from = Point3(values[0], values[1], values[2]);
+      scene.look_at = Point3(values[3], values[4], values[5]);
+      scene.up = Vec3(values[6], values[7], values[8]);
+      scene.vfov = values[9];
+      scene.aperture = values[10];
+      scene.focus_distance = count == 12 ? values[11] : 0;
+    } else if (keyword == "shutter") {
+      if (tokens.size() != 3 || !numbers(tokens, 1, 2, values) ||
+          values[1] < values[0]) {
+        message = "expected shutter <open time> <close time>";
+        return false;
+      }
+      scene.shutter_open = values[0];
+      scene.shutter_close = values[1];
+    } else if (keyword == "view") {
+      size_t count = tokens.size() - 2;
+      if (tokens.size() < 2 || (count != 13 && count != 14) ||
+          !numbers(tokens, 2, count, values) || values[0] < 1 ||
+          values[1] < 1) {
+        message =
+            "expected view <name> <width> <height> <from> <at> <up> <vfov> "
+            "<aperture> [<focus>]";
+        return false;
+      }
+      View view{std::string(tokens[1]),
+                static_cast<int>(values[0]),
+                static_cast<int>(values[1]),
+                Point3(values[2], values[3], values[4]),
+                Point3(values[5], values[6], values[7]),
+                Vec3(values[8], values[9], values[10]),
+                values[11],
+                values[12],
+                count == 14 ? values[13] : 0};
+      scene.views.push_back(view);
+    } else if (keyword == "turntable") {
+      if (tokens.size() != 2 || !numbers(tokens, 1, 1, values) ||
+          values[0] < 1 || values[0] > 10000) {
+        message = "expected turntable <count>";
+        return false;
+      }
+      const int count = static_cast<int>(values[0]);
+      const Vec3 offset = scene.look_from - scene.look_at;
+      for (int k = 0; k < count; ++k) {
+        double angle = 2 * pi * k / count;
+        Vec3 orbit(offset.x() * std::cos(angle) - offset.z() * std::sin(angle),
+                   offset.y(),
+                   offset.x() * std::sin(angle) + offset.z() * std::cos(angle));
+        char name[16];
+        snprintf(name, sizeof(name), "turn_%03d", k);
+        View view = scene.view(name);
+        view.look_from = scene.look_at + orbit;
+        scene.views.push_back(view);
+      }
+    } else if (keyword == "stereo") {
+      if (tokens.size() != 2 || !numbers(tokens, 1, 1, values)) {
+        message = "expected stereo <eye distance>";
+        return false;
+      }
+      // Parallel eyes, offset along the camera's horizontal axis.
+      Vec3 right = unit_vector(
+          cross(scene.up, scene.look_from - scene.look_at));
+      for (int side = -1; side <= 1; side += 2) {
+        View view = scene.view(side < 0 ? "left" : "right");
+        view.look_from += 0.5 * side * values[0] * right;
+        view.look_at += 0.5 * side * values[0] * right;
+        scene.views.push_back(view);
+      }
+    } else if (keyword == "background") {
+      if (tokens.size() != 4 || !vector(tokens, 1, scene.background)) {
+        message = "expected background <r g b>";
+        return false;
+      }
+    } else if (keyword == "environment") {
+      if (tokens.size() < 2 || tokens.size() > 3 ||
+          (tokens.size() == 3 &&
+           !number(tokens[2], scene.environment_intensity))) {
+        message = "expected environment <file> [<intensity>]";
+        return false;
+      }
+      scene.environment_file = std::string(tokens[1]);
+    } else if (keyword == "texture") {
+      TextureSpec spec;
+      if (tokens.size() == 6 && tokens[2] == "solid" &&
+          vector(tokens, 3, spec.even)) {
+        spec.type = "solid";
+      } else if (tokens.size() == 9 && tokens[2] == "checker" &&
+                 vector(tokens, 3, spec.even) && vector(tokens, 6, spec.odd)) {
+        spec.type = "checker";
+      } else if (tokens.size() == 5 && tokens[2] == "checker") {
+        spec.type = "checker";
+        spec.even_name = std::string(tokens[3]);
+        spec.odd_name = std::string(tokens[4]);
+      } else if (tokens.size() == 4 && tokens[2] == "image") {
+        spec.type = "image";
+        spec.file = std::string(tokens[3]);
+      } else {
+        message = "bad texture definition";
+        return false;
+      }
+      definitions.textures[std::string(tokens[1])] = spec;
+    } else if (keyword == "material") {
+      MaterialSpec spec;
+      if (tokens.size() < 3) {
+        message = "expected material <name> <material>";
+        return false;
+      }
+      if (!material(tokens, 2, spec, message)) {
+        return false;
+      }
+      definitions.materials[std::string(tokens[1])] = spec;
+    } else if (keyword == "mesh") {
+      MeshSpec mesh{std::string(), Vec3(), 0, {std::string(), {}, line}};
+      if (tokens.size() < 7 || !vector(tokens, 2, mesh.offset) ||
+          !number(tokens[5], mesh.scale) || !(mesh.scale > 0)) {
+        message = "expected mesh <file> <x y z> <scale> <material>";
+        return false;
+      }
+      mesh.file = std::string(tokens[1]);
+      scene.shape_hash += line_hash(Tokens(tokens.begin(), tokens.begin() + 6));
+      if (tokens.size() == 7) {
+        mesh.material.name = std::string(tokens[6]);
+      } else if (!material(tokens, 6, mesh.material.spec, message)) {
+        return false;
+      }
+      definitions.meshes.push_back(mesh);
+    } else if (keyword == "moving_sphere") {
+      MovingSpec moving{{}, 0, {std::string(), {}, line}};
+      size_t k = 2;
+      Point3 center;
+      while (k + 3 < tokens.size() && vector(tokens, k, center)) {
+        moving.centers.push_back(center);
+        k += 3;
+      }
+      if (tokens.size() < 2 || !number(tokens[1], moving.radius) ||
+          moving.centers.empty() || k >= tokens.size()) {
+        message = "expected moving_sphere <radius> <x y z>... <material>";
+        return false;
+      }
+      scene.shape_hash += line_hash(Tokens(tokens.begin(), tokens.begin() + k));
+      if (k + 1 == tokens.size()) {
+        moving.material.name = std::string(tokens[k]);
+      } else if (!material(tokens, k, moving.material.spec, message)) {
+        return false;
+      }
+      definitions.moving.push_back(moving);
+    } else if (keyword == "sphere_field") {
+      if (tokens.size() < 2 || tokens.size() > 3 ||
+          !numbers(tokens, 1, tokens.size() - 1, values) || values[0] < 0 ||
+          values[0] > 1e9) {
+        message = "expected sphere_field <count> [<seed>]";
+        return false;
+      }
+      definitions.fields.push_back(
+          {static_cast<size_t>(values[0]),
+           tokens.size() == 3 ? static_cast<uint64_t>(values[1]) : 0});
+    } else {
+      message = "unknown statement '" + std::string(keyword) + "'";
+      return false;
+    }
+    return true;
+  }
+
+  static shared_ptr<Texture> make_texture(
+      const std::string& name, const Definitions& definitions,
+      std::map<std::string, shared_ptr<Texture>>& made, int depth = 0) {
+    auto found = made.find(name);
+    if (found != made.end()) {
+      return found->second;
+    }
+    auto spec = definitions.textures.find(name);
+    if (spec == definitions.textures.end() || depth > 16) {
+      return nullptr;
+    }
+
+    const TextureSpec& t = spec->second;
+    shared_ptr<Texture> texture;
+    if (t.type == "solid") {
+      texture = make_shared<SolidColor>(t.even);
+    } else if (t.type == "image") {
+      auto image = make_shared<ImageTexture>(
+          relative_to(definitions.directory, t.file));
+      if (!image->valid()) {
+        return nullptr;
+      }
+      texture = image;
+    } else if (t.even_name.empty()) {
+      texture = make_shared<CheckerTexture>(t.even, t.odd);
+    } else {
+      auto even = make_texture(t.even_name, definitions, made, depth + 1);
+      auto odd = make_texture(t.odd_name, definitions, made, depth + 1);
+      if (!even || !odd) {
+        return nullptr;
+      }
+      texture = make_shared<CheckerTexture>(even, odd);
+    }
+    made[name] = texture;
+    return texture;
+  }
+
+  static shared_ptr<Material> make_material(
+      const MaterialSpec& spec, const Definitions& definitions,
+      std::map<std::string, shared_ptr<Texture>>& textures) {
+    if (spec.type == "lambertian") {
+      if (spec.texture.empty()) {
+        return make_shared<Lambertian>(spec.color);
+      }
+      auto texture = make_texture(spec.texture, definitions, textures);
+      return texture ? make_shared<Lambertian>(texture) : nullptr;
+    }
+    if (spec.type == "metal") {
+      return make_shared<Metal>(spec.color, spec.parameter);
+    }
+    if (spec.type == "dielectric") {
+      return make_shared<Dielectric>(spec.parameter);
+    }
+    return make_shared<DiffuseLight>(spec.color);
+  }
+
+  // Returns the shared material for reference, or nullptr after reporting
+  // why there is none. line is the reference's line in the file.
+  static shared_ptr<Material> resolve(const std::string& file_name,
+                                      size_t line,
+                                      const MaterialReference& reference,
+                                      const Definitions& definitions,
+                                      Materials& materials) {
+    MaterialSpec spec = reference.spec;
+    if (!reference.name.empty()) {
+      auto named = definitions.materials.find(reference.name);
+      if (named == definitions.materials.end()) {
+        report(file_name, line, "unknown material '" + reference.name + "'");
+        return nullptr;
+      }
+      spec = named->second;
+    }
+
+    auto& material = materials.by_key[spec.key()];
+    if (!material) {
+      material = make_material(spec, definitions, materials.textures);
+    }
+    if (!material) {
+      report(file_name, line,
+             "unknown or unreadable texture '" + spec.texture + "'");
+    }
+    return material;
+  }
+
+  // Creates the deduplicated materials and packs the spheres, those of the
+  // file and those of the fields, into scene.spheres.
+  bool build(const std::string& file_name, const std::vector<Chunk>& chunks,
+             const Definitions& definitions, Materials& materials,
+             Scene& scene) const {
+    SphereStore& store = scene.spheres;
+    std::unordered_map<const Material*, uint32_t> store_index;
+    std::vector<std::vector<uint32_t>> resolved(chunks.size());
+
+    bool ok = true;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      for (const MaterialReference& reference : chunks[c].materials) {
+        auto material =
+            resolve(file_name, chunks[c].first_line + reference.line,
+                    reference, definitions, materials);
+        if (!material) {
+          ok = false;
+          continue;
+        }
+        auto [it, added] = store_index.emplace(
+            material.get(), static_cast<uint32_t>(store.materials.size()));
+        if (added) {
+          store.materials.push_back(material);
+        }
+        resolved[c].push_back(it->second);
+      }
+    }
+    if (!ok) {
+      return false;
+    }
+
+    // Spheres are packed in parallel into their final slots.
+    std::vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      offsets[c + 1] = offsets[c] + chunks[c].spheres.size();
+    }
+    store.resize(offsets.back());
+
+    auto pack = [&](size_t c) {
+      size_t k = offsets[c];
+      for (const SphereRecord& sphere : chunks[c].spheres) {
+        store.set(k++, sphere.center, sphere.radius,
+                  resolved[c][sphere.material]);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t c = 1; c < chunks.size(); ++c) {
+      threads.emplace_back(pack, c);
+    }
+    pack(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    for (const FieldSpec& field : definitions.fields) {
+      generate_sphere_field(store, field.count, field.seed, num_threads);
+    }
+
+    scene.primitive_count = store.size();
+    scene.material_count = store.materials.size();
+    scene.lights.clear();
+    store.add_lights(scene.lights);
+    return true;
+  }
+
+  // Loads the mesh files and places them. Emissive meshes are not in the
+  // light tree; their light reaches other surfaces through bounces that hit
+  // them.
+  static bool build_meshes(const std::string& file_name,
+                           const Definitions& definitions,
+                           Materials& materials, Scene& scene) {
+    std::map<std::string, shared_ptr<const MeshData>> loaded;
+    scene.meshes.clear();
+    for (const MeshSpec& mesh : definitions.meshes) {
+      auto material = resolve(file_name, mesh.material.line, mesh.material,
+                              definitions, materials);
+      if (!material) {
+        return false;
+      }
+
+      std::string path = relative_to(definitions.directory, mesh.file);
+      auto& data = loaded[path];
+      if (!data) {
+        data = load_obj(path);
+        scene.files.push_back(path);
+      }
+      if (!data) {
+        report(file_name, mesh.material.line, "cannot load mesh " + path);
+        return false;
+      }
+      // The statement says where the mesh goes; the file says its shape.
+      scene.shape_hash += data->file_hash;
+      scene.content_hash += data->file_hash;
+      scene.meshes.push_back(
+          make_shared<TriangleMesh>(data, material, mesh.offset, mesh.scale));
+    }
+    return true;
+  }
+
+  // Creates the moving spheres under one MotionBvh. Like emissive meshes,
+  // emissive moving spheres are not in the light tree and light other
+  // surfaces through bounces that hit them.
+  static bool build_moving(const std::string& file_name,
+                           const Definitions& definitions,
+                           Materials& materials, Scene& scene) {
+    std::vector<shared_ptr<Hittable>> spheres;
+    for (const MovingSpec& moving : definitions.moving) {
+      auto material = resolve(file_name, moving.material.line,
+                              moving.material, definitions, materials);
+      if (!material) {
+        return false;
+      }
+      spheres.push_back(
+          make_shared<MovingSphere>(moving.centers, moving.radius, material));
+    }
+    scene.moving =
+        spheres.empty() ? nullptr : make_shared<MotionBvh>(std::move(spheres));
+    return true;
+  }
+};
+
+/// @brief Loads file_name into scene with the default loader.
+inline bool load_scene(const std::string& file_name, Scene& scene) {
+  return SceneLoader().load(file_name, scene);
+}
+
+#endif  // _RAY_TRACING_LIB_SCENE_FILE_HPP_
@@ -0,0 +1,290 @@
+#ifndef _RAY_TRACING_LIB_SOCKET_HPP_
+#define _RAY_TRACING_LIB_SOCKET_HPP_
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+
+// Stream sockets for talking to other processes. An address of the form
+// <host>:<port> is a TCP socket, anything else the path of a Unix-domain
+// socket. An empty host is the loopback address, so :<port> is only
+// reachable from the same machine; 0.0.0.0:<port> listens on every IPv4
+// interface.
+
+/// @brief Connected stream socket, closed when destroyed.
+class Connection {
+ public:
+  Connection() {}
+  explicit Connection(int fd) : fd_(fd) {}
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+  Connection(Connection&& other)
+      : fd_(other.fd_), pending_(std::move(other.pending_)) {
+    other.fd_ = -1;
+  }
+  Connection& operator=(Connection&& other) {
+    std::swap(fd_, other.fd_);
+    std::swap(pending_, other.pending_);
+    return *this;
+  }
+  ~Connection() { close(); }
+
+  /// @brief Connects to address. Returns an invalid connection on failure.
+  static Connection connect(const std::string& address) {
+    std::string host, port;
+    if (!tcp_address(address, host, port)) {
+      sockaddr_un name;
+      if (!unix_address(address, name)) {
+        return Connection();
+      }
+      Connection connection(::socket(AF_UNIX, SOCK_STREAM, 0));
+      if (connection.valid() &&
+          ::connect(connection.fd_, reinterpret_cast<sockaddr*>(&name),
+                    sizeof(name)) != 0) {
+        connection.close();
+      }
+      return connection;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+      return Connection();
+    }
+    Connection connection;
+    for (addrinfo* a = found; a && !connection.valid(); a = a->ai_next) {
+      connection = Connection(
+          ::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+      if (connection.valid() &&
+          ::connect(connection.fd_, a->ai_addr, a->ai_addrlen) != 0) {
+        connection.close();
+      }
+    }
+    ::freeaddrinfo(found);
+    if (connection.valid()) {
+      int on = 1;
+      ::setsockopt(connection.fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return connection;
+  }
+
+  bool valid() const { return fd_ >= 0; }
+  int fd() const { return fd_; }
+
+  void close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    fd_ = -1;
+  }
+
+  /// @brief Sends all bytes of data. False if the peer is gone.
+  bool send_all(const void* data, size_t bytes) const {
+    auto p = static_cast<const char*>(data);
+    while (bytes > 0) {
+      ssize_t sent = ::send(fd_, p, bytes, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent <= 0) {
+        return false;
+      }
+      p += sent;
+      bytes -= sent;
+    }
+    return true;
+  }
+
+  /// @brief Receives exactly bytes into data. False at the end of the
+  /// stream or on an error. Does not see what receive_line has buffered,
+  /// so a connection uses one or the other.
+  bool receive_all(void* data, size_t bytes) const {
+    auto p = static_cast<char*>(data);
+    while (bytes > 0) {
+      ssize_t received = ::recv(fd_, p, bytes, 0);
+      if (received < 0 && errno == EINTR) {
+        continue;
+      }
+      if (received <= 0) {
+        return false;
+      }
+      p += received;
+      bytes -= received;
+    }
+    return true;
+  }
+
+  /// @brief Receives the next line, without its newline. False at the end
+  /// of the stream, on an error or for a line longer than max_length.
+  bool receive_line(std::string& line, size_t max_length = 1 << 16) {
+    size_t end;
+    while ((end = pending_.find('\n')) == std::string::npos) {
+      if (pending_.size() > max_length) {
+        return false;
+      }
+      char buffer[4096];
+      ssize_t received = ::recv(fd_, buffer, sizeof(buffer), 0);
+      if (received < 0 && errno == EINTR) {
+        continue;
+      }
+      if (received <= 0) {
+        return false;
+      }
+      pending_.append(buffer, received);
+    }
+    line = pending_.substr(0, end);
+    pending_.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    return true;
+  }
+
+  // Splits <host>:<port>, where an empty host is the IPv4 loopback address.
+  // False for a Unix-domain socket path.
+  static bool tcp_address(const std::string& address, std::string& host,
+                          std::string& port) {
+    size_t colon = address.find_last_of(':');
+    if (colon == std::string::npos || colon + 1 == address.size() ||
+        address.find('/') != std::string::npos) {
+      return false;
+    }
+    for (size_t i = colon + 1; i < address.size(); ++i) {
+      if (address[i] < '0' || address[i] > '9') {
+        return false;
+      }
+    }
+    host = colon > 0 ? address.substr(0, colon) : "127.0.0.1";
+    port = address.substr(colon + 1);
+    return true;
+  }
+
+  static bool unix_address(const std::string& path, sockaddr_un& name) {
+    name = sockaddr_un{};
+    name.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(name.sun_path)) {
+      std::cerr << "Bad socket path '" << path << "'.\n";
+      return false;
+    }
+    std::memcpy(name.sun_path, path.c_str(), path.size() + 1);
+    return true;
+  }
+
+ private:
+  int fd_ = -1;
+  std::string pending_;  // received after the last line
+};
+
+/// @brief Listening socket. A Unix-domain socket's file is removed again
+/// when the listener is destroyed.
+class Listener {
+ public:
+  Listener() {}
+  Listener(const Listener&) = delete;
+  Listener& operator=(const Listener&) = delete;
+  ~Listener() {
+    if (!unix_path_.empty()) {
+      ::unlink(unix_path_.c_str());
+    }
+  }
+
+  bool listen(const std::string& address) {
+    std::string host, port;
+    if (Connection::tcp_address(address, host, port)) {
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo* found;
+      if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+        std::cerr << "Cannot resolve " << address << ".\n";
+        return false;
+      }
+      for (addrinfo* a = found; a && !socket_.valid(); a = a->ai_next) {
+        socket_ = Connection(
+            ::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+        int on = 1;
+        if (socket_.valid() &&
+            (::setsockopt(socket_.fd(), SOL_SOCKET, SO_REUSEADDR, &on,
+                          sizeof(on)) != 0 ||
+             ::bind(socket_.fd(), a->ai_addr, a->ai_addrlen) != 0)) {
+          socket_.close();
+        }
+      }
+      ::freeaddrinfo(found);
+    } else {
+      sockaddr_un name;
+      if (!Connection::unix_address(address, name)) {
+        return false;
+      }
+      if (!remove_stale_socket(address)) {
+        return false;
+      }
+      socket_ = Connection(::socket(AF_UNIX, SOCK_STREAM, 0));
+      if (socket_.valid() &&
+          ::bind(socket_.fd(), reinterpret_cast<sockaddr*>(&name),
+                 sizeof(name)) != 0) {
+        socket_.close();
+      }
+      if (socket_.valid()) {
+        unix_path_ = address;
+      }
+    }
+
+    if (!socket_.valid() || ::listen(socket_.fd(), 64) != 0) {
+      std::cerr << "Cannot listen on " << address << ": "
+                << std::strerror(errno) << ".\n";
+      socket_.close();
+      return false;
+    }
+    return true;
+  }
+
+  /// @brief Waits for the next connection.
+  Connection accept() const {
+    return Connection(::accept(socket_.fd(), nullptr, nullptr));
+  }
+
+  int fd() const { return socket_.fd(); }
+
+ private:
+  // Removes the socket file a listener that is gone left at path. Fails for
+  // anything else there: another file, or a socket that still accepts
+  // connections.
+  static bool remove_stale_socket(const std::string& path) {
+    struct stat info;
+    if (::lstat(path.c_str(), &info) != 0) {
+      return true;  // nothing there, or bind() will say what is wrong
+    }
+    if (!S_ISSOCK(info.st_mode)) {
+      std::cerr << "Cannot listen on " << path << ", it is not a socket.\n";
+      return false;
+    }
+    if (Connection::connect(path).valid()) {
+      std::cerr << "Cannot listen on " << path << ", it is in use.\n";
+      return false;
+    }
+    if (::unlink(path.c_str()) != 0) {
+      std::cerr << "Cannot remove stale socket " << path << ": "
+                << std::strerror(errno) << ".\n";
+      return false;
+    }
+    return true;
+  }
+
+  Connection socket_;
+  std::string unix_path_;
+};
+
+#endif  // _RAY_TRACING_LIB_SOCKET_HPP_
@@ -2,7 +2,10 @@
 #define SPHERE_HPP
 
 #include "Hittable.hpp"
+#include "Material.hpp"
+#include "Onb.hpp"
 #include "Vec3.hpp"
+#include "color.hpp"
 
 class Sphere : public Hittable {
  public:
@@ -14,12 +17,16 @@ class Sphere : public Hittable {
                    HitRecord& rec) const override;
   virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override;
 
+  virtual double pdf_value(const Point3& origin,
+                           const Vec3& direction) const override;
+  virtual Vec3 random(const Point3& origin) const override;
+  virtual double emitted_power() const override;
+
  public:
   Point3 center;
   double radius;
   shared_ptr<Material> mat_ptr;
 
- private:
   static void get_sphere_uv(const Point3& p, double& u, double& v) {
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -34,10 +41,26 @@ class Sphere : public Hittable {
     u = phi / (2 * pi);
     v = theta / pi;
   }
+
+ private:
+  // Uniformly samples the cone of directions subtended by a sphere of the
+  // given radius at the given squared distance, with the cone axis along +z.
+  static Vec3 random_to_sphere(double radius, double distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
+
+    auto phi = 2 * pi * r1;
+    auto x = std::cos(phi) * std::sqrt(1 - z * z);
+    auto y = std::sin(phi) * std::sqrt(1 - z * z);
+
+    return Vec3(x, y, z);
+  }
 };
 
 bool Sphere::hit(const Ray& r, double t_min, double t_max,
                  HitRecord& rec) const {
+  TRACE_STAT(sphere_tests++);
   Vec3 oc = r.origin() - center;
   auto a = r.direction().length_squared();
   auto half_b = dot(oc, r.direction());
@@ -63,7 +86,12 @@ bool Sphere::hit(const Ray& r, double t_min, double t_max,
   Vec3 outward_normal = (rec.p - center) / radius;
   rec.set_face_normal(r, outward_normal);
   get_sphere_uv(outward_normal, rec.u, rec.v);
+  // v runs over pi * radius of arc, u over twice that at the equator.
+  rec.footprint = r.width_at(rec.t) / (pi * radius);
   rec.mat_ptr = mat_ptr;
+  rec.primitive = HitRecord::kNoPrimitive;
+  rec.sampled_light = true;
+  TRACE_STAT(sphere_hits++);
 
   return true;
 }
@@ -75,4 +103,40 @@ bool Sphere::bounding_box(AxisAlignedBoundingBox& output_box) const {
   return true;
 }
 
+double Sphere::pdf_value(const Point3& origin, const Vec3& direction) const {
+  auto distance_squared = (center - origin).length_squared();
+  if (distance_squared <= radius * radius) {
+    return 0.0;
+  }
+
+  HitRecord rec;
+  if (!this->hit(Ray(origin, direction), 0.001, infinity, rec)) {
+    return 0.0;
+  }
+
+  auto cos_theta_max = std::sqrt(1 - radius * radius / distance_squared);
+  auto solid_angle = 2 * pi * (1 - cos_theta_max);
+
+  return 1 / solid_angle;
+}
+
+Vec3 Sphere::random(const Point3& origin) const {
+  Vec3 direction = center - origin;
+  auto distance_squared = direction.length_squared();
+  if (distance_squared <= radius * radius) {
+    return random_unit_vector();
+  }
+
+  Onb uvw;
+  uvw.build_from_w(direction);
+  return uvw.local(random_to_sphere(radius, distance_squared));
+}
+
+double Sphere::emitted_power() const {
+  // DiffuseLight emits uniformly over the surface, so a single lookup is a
+  // good enough estimate for weighting lights against each other.
+  auto radiance = luminance(mat_ptr->emitted(0.5, 0.5, center));
+  return radiance * 4 * pi * radius * radius * pi;
+}
+
 #endif
@@ -0,0 +1,183 @@
+#ifndef _RAY_TRACING_LIB_SPHERE_STORE_HPP_
+#define _RAY_TRACING_LIB_SPHERE_STORE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "AxisAlignedBoundingBox.hpp"
+#include "HittableList.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "common.hpp"
+
+/// @brief Sphere packed into 16 bytes, four to a cache line.
+struct PackedSphere {
+  float center[3];
+  float radius;
+};
+
+/// @brief Spheres as plain arrays instead of one heap object each: packed
+/// geometry, the material index of every sphere in a parallel array, and a
+/// table of the distinct materials. 20 bytes a sphere in all, against well
+/// over 100 for a Sphere behind a shared_ptr.
+///
+/// Centers and radii are rounded to floats, which moves a sphere by a
+/// relative 6e-8 at most.
+struct SphereStore {
+  std::vector<PackedSphere> spheres;
+  std::vector<uint32_t> material_of;  // index into materials
+  std::vector<shared_ptr<Material>> materials;
+
+  size_t size() const { return spheres.size(); }
+
+  void resize(size_t count) {
+    spheres.resize(count);
+    material_of.resize(count);
+  }
+
+  void set(size_t i, const Point3& center, double radius, uint32_t material) {
+    PackedSphere& s = spheres[i];
+    for (int a = 0; a < 3; ++a) {
+      s.center[a] = static_cast<float>(center[a]);
+    }
+    s.radius = static_cast<float>(radius);
+    material_of[i] = material;
+  }
+
+  void add(const Point3& center, double radius, uint32_t material) {
+    resize(size() + 1);
+    set(size() - 1, center, radius, material);
+  }
+
+  Point3 center(size_t i) const {
+    const PackedSphere& s = spheres[i];
+    return Point3(s.center[0], s.center[1], s.center[2]);
+  }
+
+  AxisAlignedBoundingBox bounds(size_t i) const {
+    Vec3 r(spheres[i].radius, spheres[i].radius, spheres[i].radius);
+    return AxisAlignedBoundingBox(center(i) - r, center(i) + r);
+  }
+
+  /// @brief Sphere i as a standalone object.
+  shared_ptr<Sphere> object(size_t i) const {
+    return make_shared<Sphere>(center(i), spheres[i].radius,
+                               materials[material_of[i]]);
+  }
+
+  /// @brief Adds the emissive spheres to lights, for light sampling.
+  void add_lights(HittableList& lights) const {
+    for (size_t i = 0; i < size(); ++i) {
+      const Material& m = *materials[material_of[i]];
+      if (!m.emitted(0.5, 0.5, center(i)).near_zero()) {
+        lights.add(object(i));
+      }
+    }
+  }
+};
+
+/// @brief Appends count small spheres resting on the plane y = 0 to store:
+/// the field of scenes/random_spheres.scene, one sphere in each cell of a
+/// square grid centered on the origin, grown to any size.
+///
+/// Materials come from a fixed palette of 833, so the material table stays
+/// small however many spheres there are: 80% diffuse, 15% metal, 3% lights
+/// and 2% glass, as in random_spheres.scene. Every cell draws from its own
+/// random stream, derived from seed and the cell's index, so the field is
+/// the same for any number of threads.
+inline void generate_sphere_field(SphereStore& store, size_t count,
+                                  uint64_t seed, int num_threads) {
+  const int levels = 8;         // per diffuse color channel
+  const int metal_levels = 4;   // per metal and light color channel, fuzz
+  const uint32_t diffuse = static_cast<uint32_t>(store.materials.size());
+  for (int i = 0; i < levels * levels * levels; ++i) {
+    auto level = [&](int k) { return (k % levels + 0.5) / levels; };
+    store.materials.push_back(make_shared<Lambertian>(
+        Color(level(i), level(i / levels), level(i / levels / levels))));
+  }
+  const uint32_t metal = static_cast<uint32_t>(store.materials.size());
+  for (int i = 0; i < metal_levels * metal_levels * metal_levels; ++i) {
+    auto level = [&](int k) {
+      return 0.5 + 0.5 * (k % metal_levels + 0.5) / metal_levels;
+    };
+    for (int f = 0; f < metal_levels; ++f) {
+      store.materials.push_back(make_shared<Metal>(
+          Color(level(i), level(i / metal_levels),
+                level(i / metal_levels / metal_levels)),
+          0.5 * (f + 0.5) / metal_levels));
+    }
+  }
+  const uint32_t light = static_cast<uint32_t>(store.materials.size());
+  for (int i = 0; i < metal_levels * metal_levels * metal_levels; ++i) {
+    auto level = [&](int k) { return (k % metal_levels + 0.5) / metal_levels; };
+    store.materials.push_back(make_shared<DiffuseLight>(
+        Color(level(i), level(i / metal_levels),
+              level(i / metal_levels / metal_levels))));
+  }
+  const uint32_t glass = static_cast<uint32_t>(store.materials.size());
+  store.materials.push_back(make_shared<Dielectric>(1.5));
+
+  const size_t first = store.size();
+  const size_t side =
+      static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  const double half = 0.5 * side;
+  store.resize(first + count);
+
+  auto generate = [&](size_t begin, size_t end) {
+    for (size_t cell = begin; cell < end; ++cell) {
+      uint64_t stream = mix_seed(seed, cell);
+      uint64_t draws = 0;
+      auto next = [&]() {
+        return (mix_seed(stream, draws++) >> 11) * 0x1.0p-53;
+      };
+      auto quantize = [](double x, int n) {
+        return std::min(n - 1, static_cast<int>(x * n));
+      };
+
+      Point3 center((cell % side) - half + 0.9 * next(), 0.2,
+                    (cell / side) - half + 0.9 * next());
+      double choose_mat = next();
+      uint32_t material;
+      if (choose_mat < 0.8) {
+        // Albedo is the product of two uniform randoms per channel.
+        int k = 0;
+        for (int a = 0, scale = 1; a < 3; ++a, scale *= levels) {
+          k += quantize(next() * next(), levels) * scale;
+        }
+        material = diffuse + k;
+      } else if (choose_mat < 0.95) {
+        int k = 0;
+        for (int a = 0, scale = 1; a < 3; ++a, scale *= metal_levels) {
+          k += quantize(next(), metal_levels) * scale;
+        }
+        material = metal + k * metal_levels + quantize(next(), metal_levels);
+      } else if (choose_mat < 0.98) {
+        int k = 0;
+        for (int a = 0, scale = 1; a < 3; ++a, scale *= metal_levels) {
+          k += quantize(next(), metal_levels) * scale;
+        }
+        material = light + k;
+      } else {
+        material = glass;
+      }
+      store.set(first + cell, center, 0.2, material);
+    }
+  };
+
+  size_t threads_used = std::max<size_t>(
+      1, std::min<size_t>(num_threads, count / (1 << 16) + 1));
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < threads_used; ++t) {
+    threads.emplace_back(generate, count * t / threads_used,
+                         count * (t + 1) / threads_used);
+  }
+  generate(0, count / threads_used);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+#endif  // _RAY_TRACING_LIB_SPHERE_STORE_HPP_
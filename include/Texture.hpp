@@ -6,6 +6,13 @@
 class Texture {
  public:
   virtual Color value(double u, double v, const Point3& p) const = 0;
+
+  /// @brief Color averaged over a ray footprint about footprint wide in
+  /// (u, v) units. Only textures that can be filtered override this.
+  virtual Color filtered_value(double u, double v, const Point3& p,
+                               double footprint) const {
+    return value(u, v, p);
+  }
 };
 
 class SolidColor : public Texture {
@@ -35,9 +42,19 @@ class CheckerTexture : public Texture {
       : even(make_shared<SolidColor>(c1)), odd(make_shared<SolidColor>(c2)) {}
 
   virtual Color value(double u, double v, const Point3& p) const override {
+    return is_odd(p) ? odd->value(u, v, p) : even->value(u, v, p);
+  }
+
+  virtual Color filtered_value(double u, double v, const Point3& p,
+                               double footprint) const override {
+    return is_odd(p) ? odd->filtered_value(u, v, p, footprint)
+                     : even->filtered_value(u, v, p, footprint);
+  }
+
+  static bool is_odd(const Point3& p) {
     auto sines =
         std::sin(10 * p.x()) * std::sin(10 * p.y()) * std::sin(10 * p.z());
-    return (sines < 0) ? odd->value(u, v, p) : even->value(u, v, p);
+    return sines < 0;
   }
 
  public:
@@ -0,0 +1,441 @@
+#ifndef _RAY_TRACING_LIB_TEXTURE_CACHE_HPP_
+#define _RAY_TRACING_LIB_TEXTURE_CACHE_HPP_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Image.hpp"
+#include "common.hpp"
+
+/// @brief Mipmapped 8-bit textures paged in from disk, tile by tile, into a
+/// fixed memory budget shared by all render threads.
+///
+/// The first time an image is opened its mip chain is built and written
+/// next to it as <image>.tiles, cut into tile_size x tile_size tiles of sRGB
+/// texels so that a tile is one 4 KiB page. Later runs reuse that file while
+/// the image is unchanged. Tiles are read into a pool of slots on first use
+/// and evicted with the clock algorithm, an approximation of least recently
+/// used that costs readers one flag.
+///
+/// Reads take no lock. Every slot has a sequence number that is odd while
+/// the slot is refilled; a reader that sees it change retries. Only misses
+/// serialize, on a mutex.
+class TextureCache {
+ public:
+  static const int tile_size = 32;
+  static const int tile_texels = tile_size * tile_size;
+  static const int max_textures = 1024;
+
+  /// @brief budget_bytes is the memory for resident tiles. It is only
+  /// allocated when the first texture is opened.
+  explicit TextureCache(size_t budget_bytes = size_t(256) << 20)
+      : slot_count_(std::max<size_t>(16, budget_bytes / tile_bytes)),
+        files_(max_textures) {}
+
+  ~TextureCache() {
+    for (auto& file : files_) {
+      if (file && file->fd >= 0) {
+        ::close(file->fd);
+      }
+    }
+  }
+
+  TextureCache(const TextureCache&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+
+  /// @brief The cache image textures use unless they are given another.
+  static TextureCache& shared() {
+    static TextureCache cache;
+    return cache;
+  }
+
+  /// @brief Opens image_file, building its tiled file first if it is
+  /// missing or out of date. Returns the texture's id, the same one for
+  /// every open of a file, or -1 after reporting why it can not be read.
+  int open(const std::string& image_file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int id = 0; id < file_count_; ++id) {
+      if (files_[id]->name == image_file) {
+        return id;
+      }
+    }
+    if (file_count_ == max_textures) {
+      std::cerr << "Too many textures, cannot open " << image_file << ".\n";
+      return -1;
+    }
+
+    struct stat source;
+    if (::stat(image_file.c_str(), &source) != 0) {
+      std::cerr << "Cannot open texture " << image_file << ".\n";
+      return -1;
+    }
+    Header expected{kMagic, kVersion, 0, 0, 0, tile_size,
+                    static_cast<uint64_t>(source.st_size),
+                    static_cast<int64_t>(source.st_mtime)};
+
+    std::string tiles_file = image_file + ".tiles";
+    auto file = std::make_unique<File>();
+    file->name = image_file;
+    if (!attach(tiles_file, expected, *file)) {
+      if (!build(image_file, tiles_file, expected) ||
+          !attach(tiles_file, expected, *file)) {
+        return -1;
+      }
+    }
+
+    if (!slots_) {
+      slots_.reset(new Slot[slot_count_]);
+      texels_.reset(new std::atomic<uint32_t>[slot_count_ * tile_texels]);
+    }
+    files_[file_count_] = std::move(file);
+    return file_count_++;
+  }
+
+  int levels(int id) const {
+    return static_cast<int>(files_[id]->levels.size());
+  }
+  int width(int id, int level) const {
+    return files_[id]->levels[level].width;
+  }
+  int height(int id, int level) const {
+    return files_[id]->levels[level].height;
+  }
+
+  /// @brief Linear color of texel (x, y) of level. Coordinates wrap around.
+  Color texel(int id, int level, int x, int y) {
+    File& file = *files_[id];
+    const Level& l = file.levels[level];
+    x %= l.width;
+    y %= l.height;
+    x += x < 0 ? l.width : 0;
+    y += y < 0 ? l.height : 0;
+
+    uint32_t tile = l.first_tile + static_cast<uint32_t>(y / tile_size) *
+                                       l.tiles_x +
+                    static_cast<uint32_t>(x / tile_size);
+    size_t offset = (y % tile_size) * tile_size + x % tile_size;
+    uint64_t key = static_cast<uint64_t>(id) << 32 | tile;
+
+    while (true) {
+      int32_t s = file.slot_of_tile[tile].load(std::memory_order_acquire);
+      if (s < 0) {
+        load(id, tile);
+        continue;
+      }
+
+      Slot& slot = slots_[s];
+      uint32_t before = slot.sequence.load(std::memory_order_acquire);
+      if ((before & 1) || slot.owner.load(std::memory_order_relaxed) != key) {
+        continue;
+      }
+      uint32_t value =
+          texels_[s * tile_texels + offset].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != before) {
+        continue;
+      }
+
+      // Only write the flag when it changes, so hot tiles do not bounce
+      // their cache line between threads.
+      if (!slot.referenced.load(std::memory_order_relaxed)) {
+        slot.referenced.store(true, std::memory_order_relaxed);
+      }
+      return decode(value);
+    }
+  }
+
+  /// @brief Tiles read from disk so far, a measure of how well the budget
+  /// fits the scene.
+  size_t tile_loads() const { return tile_loads_; }
+  size_t slot_count() const { return slot_count_; }
+
+ private:
+  static const size_t tile_bytes = tile_texels * sizeof(uint32_t);
+  static constexpr uint32_t kMagic = 0x4c495452;  // "RTIL"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint64_t kNoOwner = ~uint64_t(0);
+
+  // Stored at the start of a tiled file, which is padded to tile_bytes so
+  // that every tile is page aligned.
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t levels;
+    int32_t tile_size;
+    uint64_t source_size;  // identifies the image the tiles were made from
+    int64_t source_time;
+  };
+
+  struct Level {
+    int width;
+    int height;
+    int tiles_x;
+    uint32_t first_tile;
+  };
+
+  struct File {
+    std::string name;
+    int fd = -1;
+    std::vector<Level> levels;
+    // Slot holding each tile, or -1 when it is not resident.
+    std::unique_ptr<std::atomic<int32_t>[]> slot_of_tile;
+  };
+
+  struct Slot {
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> owner{kNoOwner};  // texture id << 32 | tile
+    std::atomic<bool> referenced{false};
+  };
+
+  static float srgb_to_linear(int c) {
+    static const std::vector<float> table = [] {
+      std::vector<float> t(256);
+      for (int i = 0; i < 256; ++i) {
+        double s = i / 255.0;
+        t[i] = static_cast<float>(
+            s <= 0.04045 ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4));
+      }
+      return t;
+    }();
+    return table[c];
+  }
+
+  static uint32_t linear_to_srgb(double l) {
+    l = clamp(l, 0.0, 1.0);
+    double s =
+        l <= 0.0031308 ? 12.92 * l : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+    return static_cast<uint32_t>(s * 255 + 0.5);
+  }
+
+  static Color decode(uint32_t value) {
+    return Color(srgb_to_linear(value & 0xff),
+                 srgb_to_linear(value >> 8 & 0xff),
+                 srgb_to_linear(value >> 16 & 0xff));
+  }
+
+  static std::vector<Level> layout(int width, int height) {
+    std::vector<Level> levels;
+    uint32_t tiles = 0;
+    while (true) {
+      Level level{width, height, (width + tile_size - 1) / tile_size, tiles};
+      tiles += level.tiles_x * ((height + tile_size - 1) / tile_size);
+      levels.push_back(level);
+      if (width == 1 && height == 1) {
+        return levels;
+      }
+      width = std::max(1, width / 2);
+      height = std::max(1, height / 2);
+    }
+  }
+
+  static uint32_t tile_count(const std::vector<Level>& levels) {
+    const Level& last = levels.back();
+    return last.first_tile + 1;
+  }
+
+  // Opens tiles_file if it was built from the image described by expected.
+  bool attach(const std::string& tiles_file, const Header& expected,
+              File& file) {
+    int fd = ::open(tiles_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    Header header;
+    if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != kMagic || header.version != kVersion ||
+        header.tile_size != tile_size ||
+        header.source_size != expected.source_size ||
+        header.source_time != expected.source_time || header.width < 1 ||
+        header.height < 1) {
+      ::close(fd);
+      return false;
+    }
+
+    std::vector<Level> levels = layout(header.width, header.height);
+    struct stat tiles;
+    if (static_cast<int>(levels.size()) != header.levels ||
+        ::fstat(fd, &tiles) != 0 ||
+        static_cast<uint64_t>(tiles.st_size) <
+            (tile_count(levels) + 1) * uint64_t(tile_bytes)) {
+      ::close(fd);
+      return false;
+    }
+
+    file.fd = fd;
+    file.levels = std::move(levels);
+    uint32_t count = tile_count(file.levels);
+    file.slot_of_tile.reset(new std::atomic<int32_t>[count]);
+    for (uint32_t t = 0; t < count; ++t) {
+      file.slot_of_tile[t].store(-1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Decodes image_file, builds its mip chain and writes it as tiles.
+  static bool build(const std::string& image_file,
+                    const std::string& tiles_file, Header header) {
+    int width, height, channels;
+    unsigned char* data =
+        stbi_load(image_file.c_str(), &width, &height, &channels, 4);
+    if (!data) {
+      std::cerr << "Cannot decode texture " << image_file << ".\n";
+      return false;
+    }
+    std::vector<uint32_t> texels(static_cast<size_t>(width) * height);
+    std::memcpy(texels.data(), data, texels.size() * sizeof(uint32_t));
+    stbi_image_free(data);
+
+    std::vector<Level> levels = layout(width, height);
+    header.width = width;
+    header.height = height;
+    header.levels = static_cast<int32_t>(levels.size());
+
+    std::string temporary = tiles_file + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file) {
+        std::cerr << "Cannot write texture tiles " << temporary << ".\n";
+        return false;
+      }
+      std::vector<uint32_t> page(tile_texels, 0);
+      std::memcpy(page.data(), &header, sizeof(header));
+      file.write(reinterpret_cast<const char*>(page.data()), tile_bytes);
+
+      for (size_t k = 0; k < levels.size(); ++k) {
+        const Level& level = levels[k];
+        int tiles_y = (level.height + tile_size - 1) / tile_size;
+        for (int ty = 0; ty < tiles_y; ++ty) {
+          for (int tx = 0; tx < level.tiles_x; ++tx) {
+            // Tiles past the edge repeat the last row and column.
+            for (int y = 0; y < tile_size; ++y) {
+              int sy = std::min(ty * tile_size + y, level.height - 1);
+              for (int x = 0; x < tile_size; ++x) {
+                int sx = std::min(tx * tile_size + x, level.width - 1);
+                page[y * tile_size + x] =
+                    texels[static_cast<size_t>(sy) * level.width + sx];
+              }
+            }
+            file.write(reinterpret_cast<const char*>(page.data()),
+                       tile_bytes);
+          }
+        }
+        if (k + 1 < levels.size()) {
+          texels = downsample(texels, level, levels[k + 1]);
+        }
+      }
+      if (!file) {
+        std::cerr << "Failed writing texture tiles " << temporary << ".\n";
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), tiles_file.c_str()) == 0;
+  }
+
+  // Box filters 2x2 blocks in linear space.
+  static std::vector<uint32_t> downsample(const std::vector<uint32_t>& texels,
+                                          const Level& from, const Level& to) {
+    std::vector<uint32_t> result(static_cast<size_t>(to.width) * to.height);
+    for (int y = 0; y < to.height; ++y) {
+      int y0 = std::min(2 * y, from.height - 1);
+      int y1 = std::min(2 * y + 1, from.height - 1);
+      for (int x = 0; x < to.width; ++x) {
+        int x0 = std::min(2 * x, from.width - 1);
+        int x1 = std::min(2 * x + 1, from.width - 1);
+        uint32_t block[4] = {texels[static_cast<size_t>(y0) * from.width + x0],
+                             texels[static_cast<size_t>(y0) * from.width + x1],
+                             texels[static_cast<size_t>(y1) * from.width + x0],
+                             texels[static_cast<size_t>(y1) * from.width + x1]};
+
+        uint32_t packed = 0;
+        for (int c = 0; c < 3; ++c) {
+          double sum = 0;
+          for (uint32_t texel : block) {
+            sum += srgb_to_linear(texel >> (8 * c) & 0xff);
+          }
+          packed |= linear_to_srgb(sum / 4) << (8 * c);
+        }
+        uint32_t alpha = 0;
+        for (uint32_t texel : block) {
+          alpha += texel >> 24;
+        }
+        result[static_cast<size_t>(y) * to.width + x] =
+            packed | (alpha / 4) << 24;
+      }
+    }
+    return result;
+  }
+
+  // Reads tile of texture id into a slot, evicting the first slot the clock
+  // hand finds that was not used since it last passed.
+  void load(int id, uint32_t tile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    File& file = *files_[id];
+    if (file.slot_of_tile[tile].load(std::memory_order_relaxed) >= 0) {
+      return;  // another thread loaded it meanwhile
+    }
+
+    uint32_t page[tile_texels];
+    off_t position = (static_cast<off_t>(tile) + 1) * tile_bytes;
+    if (::pread(file.fd, page, tile_bytes, position) !=
+        static_cast<ssize_t>(tile_bytes)) {
+      std::cerr << "Failed reading a tile of " << file.name << ".\n";
+      std::fill(page, page + tile_texels, 0);
+    }
+
+    int32_t s;
+    while (true) {
+      s = static_cast<int32_t>(hand_);
+      hand_ = (hand_ + 1) % slot_count_;
+      if (!slots_[s].referenced.exchange(false, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    Slot& slot = slots_[s];
+    uint64_t owner = slot.owner.load(std::memory_order_relaxed);
+    if (owner != kNoOwner) {
+      files_[owner >> 32]->slot_of_tile[owner & 0xffffffff].store(
+          -1, std::memory_order_relaxed);
+    }
+
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < tile_texels; ++i) {
+      texels_[s * tile_texels + i].store(page[i], std::memory_order_relaxed);
+    }
+    slot.owner.store(static_cast<uint64_t>(id) << 32 | tile,
+                     std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    slot.referenced.store(true, std::memory_order_relaxed);
+    file.slot_of_tile[tile].store(s, std::memory_order_release);
+    ++tile_loads_;
+  }
+
+  const size_t slot_count_;
+  std::unique_ptr<Slot[]> slots_;
+  std::unique_ptr<std::atomic<uint32_t>[]> texels_;
+  size_t hand_ = 0;
+  std::atomic<size_t> tile_loads_{0};
+
+  // Filled once and never resized, so readers index it without the lock.
+  std::vector<std::unique_ptr<File>> files_;
+  int file_count_ = 0;
+  std::mutex mutex_;
+};
+
+#endif  // _RAY_TRACING_LIB_TEXTURE_CACHE_HPP_
@@ -0,0 +1,138 @@
+#ifndef _RAY_TRACING_LIB_TILE_COSTS_HPP_
+#define _RAY_TRACING_LIB_TILE_COSTS_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "color.hpp"
+#include "common.hpp"
+
+/// @brief What rendering each tile of an image cost, summed over passes, to
+/// see which regions of a scene are expensive.
+///
+/// A Renderer fills it in for a job that points to it: every tile is
+/// rendered by one thread at a time and passes follow one another, so the
+/// tiles need no lock.
+class TileCosts {
+ public:
+  struct Tile {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    double seconds = 0;  // wall-clock, on the thread that rendered it
+    uint64_t samples = 0;  // camera samples
+    uint64_t rays = 0;  // all rays traced, counted with RAY_TRACING_STATS
+
+    int pixels() const { return (x1 - x0) * (y1 - y0); }
+  };
+
+  /// @brief Lays the tiles out for an image of the given size, unless they
+  /// are laid out so already, in which case their costs so far are kept.
+  void fit(int width, int height, int tile_size) {
+    tile_size = std::max(1, tile_size);
+    if (width == width_ && height == height_ && tile_size == tile_size_) {
+      return;
+    }
+    width_ = width;
+    height_ = height;
+    tile_size_ = tile_size;
+    columns_ = (width + tile_size - 1) / tile_size;
+    tiles_.clear();
+    for (int y = 0; y < height; y += tile_size) {
+      for (int x = 0; x < width; x += tile_size) {
+        Tile tile;
+        tile.x0 = x;
+        tile.y0 = y;
+        tile.x1 = std::min(x + tile_size, width);
+        tile.y1 = std::min(y + tile_size, height);
+        tiles_.push_back(tile);
+      }
+    }
+  }
+
+  /// @brief Adds to the tile whose first pixel is (x0, y0).
+  void add(int x0, int y0, double seconds, uint64_t samples, uint64_t rays) {
+    if (tiles_.empty()) {
+      return;
+    }
+    size_t index =
+        static_cast<size_t>(y0 / tile_size_) * columns_ + x0 / tile_size_;
+    if (index < tiles_.size()) {
+      tiles_[index].seconds += seconds;
+      tiles_[index].samples += samples;
+      tiles_[index].rays += rays;
+    }
+  }
+
+  const std::vector<Tile>& tiles() const { return tiles_; }
+
+  /// @brief An image of the seconds per pixel of every tile, laid out like
+  /// the accumulator's pixels: black for the cheapest tile, over red and
+  /// yellow to white for the most expensive. The colors are linear, for
+  /// writing with the usual gamma.
+  std::vector<Color> heatmap() const {
+    double lowest = infinity;
+    double highest = 0;
+    for (const Tile& tile : tiles_) {
+      double cost = tile.seconds / std::max(1, tile.pixels());
+      lowest = std::min(lowest, cost);
+      highest = std::max(highest, cost);
+    }
+
+    std::vector<Color> image(static_cast<size_t>(width_) * height_);
+    for (const Tile& tile : tiles_) {
+      double cost = tile.seconds / std::max(1, tile.pixels());
+      double x = highest > lowest ? (cost - lowest) / (highest - lowest) : 0;
+      Color shade = ramp(x);
+      shade = shade * shade;
+      for (int j = tile.y0; j < tile.y1; ++j) {
+        size_t row = static_cast<size_t>(j) * width_;
+        std::fill(image.begin() + row + tile.x0, image.begin() + row + tile.x1,
+                  shade);
+      }
+    }
+    return image;
+  }
+
+  /// @brief Writes one line per tile: its pixels, seconds, camera samples,
+  /// rays and microseconds per sample.
+  bool write_csv(const std::string& file_name) const {
+    std::ofstream file(file_name);
+    file << "x0,y0,x1,y1,seconds,samples,rays,us_per_sample\n";
+    for (const Tile& tile : tiles_) {
+      file << tile.x0 << ',' << tile.y0 << ',' << tile.x1 << ',' << tile.y1
+           << ',' << tile.seconds << ',' << tile.samples << ',' << tile.rays
+           << ','
+           << (tile.samples > 0 ? 1e6 * tile.seconds / tile.samples : 0.0)
+           << '\n';
+    }
+    if (!file) {
+      std::cerr << "Cannot write " << file_name << ".\n";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // Black, purple, red, yellow, white for x from 0 to 1.
+  static Color ramp(double x) {
+    static const Color stops[] = {Color(0, 0, 0), Color(0.4, 0, 0.5),
+                                  Color(0.9, 0.1, 0.1), Color(1, 0.8, 0),
+                                  Color(1, 1, 1)};
+    const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+    double position = clamp(x, 0, 1) * last;
+    int k = std::min(static_cast<int>(position), last - 1);
+    double f = position - k;
+    return (1 - f) * stops[k] + f * stops[k + 1];
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  int tile_size_ = 0;
+  int columns_ = 0;
+  std::vector<Tile> tiles_;
+};
+
+#endif  // _RAY_TRACING_LIB_TILE_COSTS_HPP_
@@ -0,0 +1,74 @@
+#ifndef _RAY_TRACING_LIB_TILE_WORLD_HPP_
+#define _RAY_TRACING_LIB_TILE_WORLD_HPP_
+
+#include <vector>
+
+#include "FlatScene.hpp"
+#include "Frustum.hpp"
+#include "Hittable.hpp"
+#include "HittableList.hpp"
+
+/// @brief The world as the camera rays of one image tile see it.
+///
+/// The BVH of every FlatScene in the world is culled to the tile's frustum
+/// once, so camera rays start traversal at the few nodes the tile can see
+/// instead of testing the same top-level boxes again for every ray. In a
+/// wide scene most of the tree lies outside any one tile. Other objects are
+/// hit as they are. Only valid for rays inside the frustum.
+class TileWorld : public Hittable {
+ public:
+  TileWorld(const Hittable& world, const Frustum& frustum) : world_(world) {
+    auto list = dynamic_cast<const HittableList*>(&world);
+    if (!list) {
+      add(world, frustum);
+      return;
+    }
+    for (const auto& object : list->objects) {
+      add(*object, frustum);
+    }
+  }
+
+  virtual bool hit(const Ray& r, double t_min, double t_max,
+                   HitRecord& rec) const override {
+    HitRecord part_rec;
+    bool hit_anything = false;
+    for (const Part& part : parts_) {
+      bool hit = part.spheres ? part.spheres->hit(part.entries, r, t_min,
+                                                  t_max, part_rec)
+                              : part.object->hit(r, t_min, t_max, part_rec);
+      if (hit) {
+        hit_anything = true;
+        t_max = part_rec.t;
+        rec = part_rec;
+      }
+    }
+    return hit_anything;
+  }
+
+  virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override {
+    return world_.bounding_box(output_box);
+  }
+
+ private:
+  struct Part {
+    const Hittable* object;
+    const FlatScene* spheres;  // when object is one, culled to entries
+    std::vector<uint32_t> entries;
+  };
+
+  void add(const Hittable& object, const Frustum& frustum) {
+    Part part{&object, dynamic_cast<const FlatScene*>(&object), {}};
+    if (part.spheres) {
+      part.spheres->cull(frustum, part.entries);
+      if (part.entries.empty()) {
+        return;
+      }
+    }
+    parts_.push_back(std::move(part));
+  }
+
+  const Hittable& world_;
+  std::vector<Part> parts_;
+};
+
+#endif  // _RAY_TRACING_LIB_TILE_WORLD_HPP_
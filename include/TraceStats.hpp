@@ -0,0 +1,204 @@
+#ifndef _RAY_TRACING_LIB_TRACE_STATS_HPP_
+#define _RAY_TRACING_LIB_TRACE_STATS_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Counters of what the hot paths of a render do: rays traced, BVH nodes
+// visited, spheres tested, materials scattered and how many bounces paths
+// take. They are only compiled in when RAY_TRACING_STATS is defined, which
+// `make STATS=1` does; otherwise TRACE_STAT() expands to nothing.
+
+/// @brief One thread's counts. Every thread counts into its own, aligned to
+/// a cache line of its own, so counting needs neither atomics nor shares a
+/// line with another thread's counters.
+struct alignas(64) TraceCounters {
+  enum RayType {
+    kCameraRay,
+    kSpecularRay,  // continuing a path after a mirror or glass hit
+    kDiffuseRay,   // continuing a path after a diffuse hit
+    kShadowRay,    // towards a light
+    kEnvironmentRay,  // towards a bright part of the environment map
+    kRayTypes
+  };
+  enum ScatterType {
+    kLambertianScatter,
+    kMetalScatter,
+    kDielectricScatter,
+    kLightScatter,
+    kGuidedScatter,  // a diffuse bounce the path guide chose
+    kScatterTypes
+  };
+  // Paths ending after 0 to depth_bins - 2 bounces, and after more.
+  static const int depth_bins = 65;
+
+  uint64_t rays[kRayTypes] = {};
+  uint64_t node_visits = 0;
+  uint64_t box_tests = 0;
+  uint64_t sphere_tests = 0;
+  uint64_t sphere_hits = 0;
+  uint64_t scatters[kScatterTypes] = {};
+  uint64_t path_ends[depth_bins] = {};
+  int path_depth = 0;  // the depth the current camera sample started with
+
+  /// @brief Counts a path that ends with depth bounces left.
+  void end_path(int depth) {
+    int bounces = path_depth - depth;
+    path_ends[bounces < 0 ? 0
+                          : bounces < depth_bins ? bounces
+                                                 : depth_bins - 1]++;
+  }
+
+  uint64_t ray_count() const {
+    uint64_t count = 0;
+    for (uint64_t n : rays) {
+      count += n;
+    }
+    return count;
+  }
+
+  void add(const TraceCounters& other) {
+    for (int i = 0; i < kRayTypes; ++i) {
+      rays[i] += other.rays[i];
+    }
+    node_visits += other.node_visits;
+    box_tests += other.box_tests;
+    sphere_tests += other.sphere_tests;
+    sphere_hits += other.sphere_hits;
+    for (int i = 0; i < kScatterTypes; ++i) {
+      scatters[i] += other.scatters[i];
+    }
+    for (int i = 0; i < depth_bins; ++i) {
+      path_ends[i] += other.path_ends[i];
+    }
+  }
+
+  /// @brief Writes the counts as a report, with rates per ray traced.
+  void print(std::ostream& out) const {
+    static const char* ray_names[kRayTypes] = {"camera", "specular",
+                                               "diffuse", "shadow",
+                                               "environment"};
+    static const char* scatter_names[kScatterTypes] = {
+        "lambertian", "metal", "dielectric", "light", "guided"};
+    char line[96];
+    auto row = [&](const char* name, uint64_t count, uint64_t total) {
+      snprintf(line, sizeof(line), "  %-14s %16llu %7.2f%%\n", name,
+               static_cast<unsigned long long>(count),
+               total > 0 ? 100.0 * count / total : 0.0);
+      out << line;
+    };
+
+    uint64_t ray_count = this->ray_count();
+    out << "Rays\n";
+    for (int i = 0; i < kRayTypes; ++i) {
+      row(ray_names[i], rays[i], ray_count);
+    }
+    row("total", ray_count, ray_count);
+
+    auto rate = [&](const char* name, double value, const char* unit) {
+      snprintf(line, sizeof(line), "  %-14s %16.2f%s\n", name, value, unit);
+      out << line;
+    };
+    double per_ray = ray_count > 0 ? 1.0 / ray_count : 0.0;
+    out << "Per ray\n";
+    rate("BVH nodes", node_visits * per_ray, "");
+    rate("box tests", box_tests * per_ray, "");
+    rate("sphere tests", sphere_tests * per_ray, "");
+    rate("sphere hits",
+         sphere_tests > 0 ? 100.0 * sphere_hits / sphere_tests : 0.0,
+         "% of tests");
+
+    uint64_t scatter_count = 0;
+    for (uint64_t count : scatters) {
+      scatter_count += count;
+    }
+    out << "Scatter events\n";
+    for (int i = 0; i < kScatterTypes; ++i) {
+      row(scatter_names[i], scatters[i], scatter_count);
+    }
+
+    uint64_t path_count = 0;
+    int last = 0;
+    for (int i = 0; i < depth_bins; ++i) {
+      path_count += path_ends[i];
+      last = path_ends[i] > 0 ? i : last;
+    }
+    out << "Paths ending after bounces\n";
+    for (int i = 0; i <= last; ++i) {
+      char name[16];
+      snprintf(name, sizeof(name), i < depth_bins - 1 ? "%d" : "%d+", i);
+      row(name, path_ends[i], path_count);
+    }
+  }
+};
+
+/// @brief Every thread's counters. They outlive their threads, so a render's
+/// totals include threads that have exited since.
+class TraceStats {
+ public:
+  /// @brief The calling thread's counters.
+  static TraceCounters& local() {
+    thread_local TraceCounters* counters = instance().add_thread();
+    return *counters;
+  }
+
+  /// @brief The sum over all threads. Only exact while no thread counts,
+  /// such as after a render finished.
+  static TraceCounters total() {
+    TraceStats& stats = instance();
+    std::lock_guard<std::mutex> lock(stats.mutex_);
+    TraceCounters sum;
+    for (const auto& counters : stats.threads_) {
+      sum.add(*counters);
+    }
+    return sum;
+  }
+
+  /// @brief Zeroes all threads' counters, e.g. between renders.
+  static void reset() {
+    TraceStats& stats = instance();
+    std::lock_guard<std::mutex> lock(stats.mutex_);
+    for (auto& counters : stats.threads_) {
+      *counters = TraceCounters();
+    }
+  }
+
+ private:
+  static TraceStats& instance() {
+    static TraceStats stats;
+    return stats;
+  }
+
+  TraceCounters* add_thread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(std::make_unique<TraceCounters>());
+    return threads_.back().get();
+  }
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<TraceCounters>> threads_;
+};
+
+/// @brief Rays the calling thread traced so far, 0 without
+/// RAY_TRACING_STATS.
+inline uint64_t traced_rays() {
+#ifdef RAY_TRACING_STATS
+  return TraceStats::local().ray_count();
+#else
+  return 0;
+#endif
+}
+
+#ifdef RAY_TRACING_STATS
+/// @brief Applies statement to the calling thread's TraceCounters, as in
+/// TRACE_STAT(node_visits += visited).
+#define TRACE_STAT(statement) (TraceStats::local().statement)
+#else
+#define TRACE_STAT(statement) ((void)0)
+#endif
+
+#endif  // _RAY_TRACING_LIB_TRACE_STATS_HPP_
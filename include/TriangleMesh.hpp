@@ -0,0 +1,301 @@
+#ifndef _RAY_TRACING_LIB_TRIANGLE_MESH_HPP_
+#define _RAY_TRACING_LIB_TRIANGLE_MESH_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Hittable.hpp"
+#include "LinearBvh.hpp"
+#include "common.hpp"
+
+/// @brief Texture coordinates of a vertex.
+struct TexCoord {
+  double u;
+  double v;
+};
+
+/// @brief Up to width triangles in structure-of-arrays form, so the
+/// intersection test runs over all of them in lock step and compiles to
+/// vector instructions. Unused lanes hold degenerate triangles, which never
+/// hit.
+struct TrianglePacket {
+  static const int width = 8;
+
+  float v0[3][width];
+  float e1[3][width];  // v1 - v0
+  float e2[3][width];  // v2 - v0
+  uint32_t triangle[width];
+
+  /// @brief Moller-Trumbore test of every lane against the ray (o, d).
+  /// Returns the closest lane hit within (t_min, t_max), or -1, with its
+  /// distance and barycentric coordinates.
+  int intersect(const float o[3], const float d[3], float t_min, float t_max,
+                float& t_hit, float& b1, float& b2) const {
+    float t[width];
+    float u[width];
+    float v[width];
+
+    for (int i = 0; i < width; ++i) {
+      float px = d[1] * e2[2][i] - d[2] * e2[1][i];
+      float py = d[2] * e2[0][i] - d[0] * e2[2][i];
+      float pz = d[0] * e2[1][i] - d[1] * e2[0][i];
+      float det = e1[0][i] * px + e1[1][i] * py + e1[2][i] * pz;
+      float inverse_det = 1.0f / det;
+
+      float sx = o[0] - v0[0][i];
+      float sy = o[1] - v0[1][i];
+      float sz = o[2] - v0[2][i];
+      float uu = (sx * px + sy * py + sz * pz) * inverse_det;
+
+      float qx = sy * e1[2][i] - sz * e1[1][i];
+      float qy = sz * e1[0][i] - sx * e1[2][i];
+      float qz = sx * e1[1][i] - sy * e1[0][i];
+      float vv = (d[0] * qx + d[1] * qy + d[2] * qz) * inverse_det;
+      float tt = (e2[0][i] * qx + e2[1][i] * qy + e2[2][i] * qz) * inverse_det;
+
+      // A zero determinant turns everything into inf or NaN, which fails
+      // the comparisons. The tests are combined with & rather than && so
+      // the loop has no branches.
+      bool hit = (uu >= 0) & (vv >= 0) & (uu + vv <= 1) & (tt > t_min) &
+                 (tt < t_max);
+      t[i] = hit ? tt : INFINITY;
+      u[i] = uu;
+      v[i] = vv;
+    }
+
+    int best = -1;
+    float closest = t_max;
+    for (int i = 0; i < width; ++i) {
+      if (t[i] < closest) {
+        closest = t[i];
+        best = i;
+      }
+    }
+    if (best >= 0) {
+      t_hit = closest;
+      b1 = u[best];
+      b2 = v[best];
+    }
+    return best;
+  }
+};
+
+/// @brief Vertex and index buffers of an indexed triangle mesh with its own
+/// BVH. Built once and shared by every TriangleMesh that places it in the
+/// scene.
+///
+/// The BVH leaves hold up to one packet of triangles each, so a leaf is a
+/// single packet intersection.
+class MeshData {
+ public:
+  /// @brief normals and uvs are per vertex and may be empty. indices holds
+  /// three vertex indices per triangle.
+  MeshData(std::vector<Point3> positions, std::vector<Vec3> normals,
+           std::vector<TexCoord> uvs, std::vector<uint32_t> indices)
+      : positions(std::move(positions)),
+        normals(std::move(normals)),
+        uvs(std::move(uvs)),
+        indices(std::move(indices)) {
+    build();
+  }
+
+  size_t triangle_count() const { return indices.size() / 3; }
+
+  /// @brief Hash of the contents of the file the mesh was loaded from, if
+  /// any, so caches keyed on the scene notice when the file changes.
+  uint64_t file_hash = 0;
+
+  const AxisAlignedBoundingBox& bounds() const { return bounds_; }
+
+  /// @brief Closest triangle hit by r within (t_min, t_max).
+  bool intersect(const Ray& r, double t_min, double t_max, double& t,
+                 uint32_t& triangle, double& b1, double& b2) const {
+    const float o[3] = {static_cast<float>(r.origin().x()),
+                        static_cast<float>(r.origin().y()),
+                        static_cast<float>(r.origin().z())};
+    const float d[3] = {static_cast<float>(r.direction().x()),
+                        static_cast<float>(r.direction().y()),
+                        static_cast<float>(r.direction().z())};
+    const float near = static_cast<float>(t_min);
+
+    bool found = false;
+    LinearBvh::traverse(
+        nodes_.data(), nodes_.size(), r, t_min, t_max,
+        [&](uint32_t packet, uint32_t, double& t_far) {
+          float t_hit, u, v;
+          int lane = packets_[packet].intersect(
+              o, d, near, static_cast<float>(t_far), t_hit, u, v);
+          if (lane < 0) {
+            return false;
+          }
+          t_far = t_hit;
+          t = t_hit;
+          triangle = packets_[packet].triangle[lane];
+          b1 = u;
+          b2 = v;
+          found = true;
+          return true;
+        });
+    return found;
+  }
+
+  /// @brief Geometric and interpolated shading normal and texture
+  /// coordinates at barycentric (b1, b2) of triangle. Without per-vertex
+  /// uvs the barycentrics are returned.
+  void surface(uint32_t triangle, double b1, double b2, Vec3& geometric,
+               Vec3& shading, double& u, double& v) const {
+    const uint32_t* t = &indices[3 * triangle];
+    const Point3& p0 = positions[t[0]];
+    geometric = unit_vector(cross(positions[t[1]] - p0, positions[t[2]] - p0));
+
+    double b0 = 1 - b1 - b2;
+    if (normals.empty()) {
+      shading = geometric;
+    } else {
+      shading = unit_vector(b0 * normals[t[0]] + b1 * normals[t[1]] +
+                            b2 * normals[t[2]]);
+    }
+
+    if (uvs.empty()) {
+      u = b1;
+      v = b2;
+    } else {
+      u = b0 * uvs[t[0]].u + b1 * uvs[t[1]].u + b2 * uvs[t[2]].u;
+      v = b0 * uvs[t[0]].v + b1 * uvs[t[1]].v + b2 * uvs[t[2]].v;
+    }
+  }
+
+  /// @brief Length in (u, v) units per unit of length on triangle, from the
+  /// ratio of its areas in texture space and in object space.
+  double texture_scale(uint32_t triangle) const {
+    const uint32_t* t = &indices[3 * triangle];
+    const Point3& p0 = positions[t[0]];
+    double area = cross(positions[t[1]] - p0, positions[t[2]] - p0).length();
+
+    double uv_area = 1;  // barycentric (u, v)
+    if (!uvs.empty()) {
+      double du1 = uvs[t[1]].u - uvs[t[0]].u;
+      double dv1 = uvs[t[1]].v - uvs[t[0]].v;
+      double du2 = uvs[t[2]].u - uvs[t[0]].u;
+      double dv2 = uvs[t[2]].v - uvs[t[0]].v;
+      uv_area = std::fabs(du1 * dv2 - du2 * dv1);
+    }
+    return area > 0 ? std::sqrt(uv_area / area) : 0.0;
+  }
+
+  std::vector<Point3> positions;
+  std::vector<Vec3> normals;
+  std::vector<TexCoord> uvs;
+  std::vector<uint32_t> indices;
+
+ private:
+  void build() {
+    std::vector<AxisAlignedBoundingBox> boxes(triangle_count());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      Point3 lo = positions[indices[3 * i]];
+      Point3 hi = lo;
+      for (int k = 1; k < 3; ++k) {
+        const Point3& p = positions[indices[3 * i + k]];
+        for (int a = 0; a < 3; ++a) {
+          lo[a] = fmin(lo[a], p[a]);
+          hi[a] = fmax(hi[a], p[a]);
+        }
+      }
+      boxes[i] = AxisAlignedBoundingBox(lo, hi);
+    }
+
+    LinearBvh bvh;
+    bvh.max_leaf_size = TrianglePacket::width;
+    bvh.sah_leaves = false;
+    bvh.build(boxes);
+
+    // Pack every leaf into one packet and point the leaf at it.
+    packets_.clear();
+    for (LinearBvhNode& node : bvh.nodes) {
+      if (!node.leaf()) {
+        continue;
+      }
+      TrianglePacket packet{};
+      for (int lane = 0; lane < node.count; ++lane) {
+        uint32_t triangle = bvh.order[node.offset + lane];
+        const uint32_t* t = &indices[3 * triangle];
+        const Point3& p0 = positions[t[0]];
+        Vec3 e1 = positions[t[1]] - p0;
+        Vec3 e2 = positions[t[2]] - p0;
+        for (int a = 0; a < 3; ++a) {
+          packet.v0[a][lane] = static_cast<float>(p0[a]);
+          packet.e1[a][lane] = static_cast<float>(e1[a]);
+          packet.e2[a][lane] = static_cast<float>(e2[a]);
+        }
+        packet.triangle[lane] = triangle;
+      }
+      node.offset = static_cast<uint32_t>(packets_.size());
+      packets_.push_back(packet);
+    }
+    nodes_ = std::move(bvh.nodes);
+
+    if (!nodes_.empty()) {
+      const LinearBvhNode& root = nodes_[0];
+      bounds_ = AxisAlignedBoundingBox(
+          Point3(root.min[0], root.min[1], root.min[2]),
+          Point3(root.max[0], root.max[1], root.max[2]));
+    }
+  }
+
+  std::vector<LinearBvhNode> nodes_;
+  std::vector<TrianglePacket> packets_;
+  AxisAlignedBoundingBox bounds_;
+};
+
+/// @brief Places shared MeshData in the scene with a uniform scale and an
+/// offset, applied to the rays rather than to the vertices so any number of
+/// meshes can share one set of buffers and one BVH.
+class TriangleMesh : public Hittable {
+ public:
+  TriangleMesh(shared_ptr<const MeshData> data, shared_ptr<Material> m,
+               const Vec3& offset = Vec3(0, 0, 0), double scale = 1.0)
+      : data(data), mat_ptr(m), offset(offset), scale(scale) {}
+
+  virtual bool hit(const Ray& r, double t_min, double t_max,
+                   HitRecord& rec) const override {
+    // A uniform scale and an offset leave ray distances unchanged.
+    Ray local((r.origin() - offset) / scale, r.direction() / scale);
+
+    double t = 0, b1 = 0, b2 = 0;
+    uint32_t triangle = 0;
+    if (!data->intersect(local, t_min, t_max, t, triangle, b1, b2)) {
+      return false;
+    }
+
+    Vec3 geometric, shading;
+    data->surface(triangle, b1, b2, geometric, shading, rec.u, rec.v);
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.footprint = r.width_at(t) * data->texture_scale(triangle) / scale;
+    rec.set_face_normal(r, geometric);
+    // Keep the interpolated normal on the side the ray came from.
+    rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+    rec.mat_ptr = mat_ptr;
+    rec.primitive = HitRecord::kNoPrimitive;
+    rec.sampled_light = false;
+    return true;
+  }
+
+  virtual bool bounding_box(AxisAlignedBoundingBox& output_box) const override {
+    if (data->triangle_count() == 0) {
+      return false;
+    }
+    output_box = AxisAlignedBoundingBox(offset + scale * data->bounds().min(),
+                                        offset + scale * data->bounds().max());
+    return true;
+  }
+
+ public:
+  shared_ptr<const MeshData> data;
+  shared_ptr<Material> mat_ptr;
+  Vec3 offset;
+  double scale;
+};
+
+#endif  // _RAY_TRACING_LIB_TRIANGLE_MESH_HPP_
@@ -0,0 +1,129 @@
+#ifndef _RAY_TRACING_LIB_WORLD_HPP_
+#define _RAY_TRACING_LIB_WORLD_HPP_
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "EnvironmentMap.hpp"
+#include "FlatScene.hpp"
+#include "Integrator.hpp"
+#include "LightTree.hpp"
+#include "PathGuide.hpp"
+#include "SceneFile.hpp"
+#include "common.hpp"
+
+/// @brief A scene ready to render: its settings and objects, and the light
+/// and background lookups built from them. Stays in one place once loaded,
+/// since the lookups point into it.
+struct World {
+  Scene scene;
+  shared_ptr<FlatScene> flat_scene = make_shared<FlatScene>();
+  std::unique_ptr<EnvironmentMap> background;
+  std::unique_ptr<LightTree> lights;
+  // file_stamp()s of the scene file and every file it reads, when loaded.
+  uint64_t files_stamp = 0;
+  bool mapped = false;  // whether the spheres came from the cache
+  double load_seconds = 0;  // loading all of it
+  double build_seconds = 0;  // building the sphere BVH, when not mapped
+};
+
+/// @brief Combined file_stamp() of scene_file and the files the scene loaded
+/// from it reads. Changes when any of them is written.
+inline uint64_t files_stamp(const std::string& scene_file, const Scene& scene) {
+  uint64_t stamp = file_stamp(scene_file);
+  for (const std::string& file : scene.files) {
+    stamp = mix_seed(stamp, file_stamp(file));
+  }
+  return stamp;
+}
+
+/// @brief Loads scene_file into world. The flattened spheres, materials and
+/// BVH are cached in <scene file>.cache; while the scene's geometry is
+/// unchanged, later loads map the cache and read only the settings, such as
+/// the camera, from the scene file. Without use_scene_cache the cache is
+/// neither read nor written.
+inline bool load_world(const std::string& scene_file, World& world,
+                       bool use_scene_cache = true) {
+  const std::string cache_file = scene_file + ".cache";
+
+  Scene& scene = world.scene;
+  auto& flat_scene = world.flat_scene;
+  SceneLoader loader;
+  loader.build_bvh = false;
+  auto load_start = std::chrono::steady_clock::now();
+
+  bool cached = false;
+  if (use_scene_cache) {
+    loader.load_geometry = false;
+    if (!loader.load(scene_file, scene)) {
+      return false;
+    }
+    cached = flat_scene->open(cache_file, scene.geometry_hash);
+  }
+
+  if (cached) {
+    scene.lights = flat_scene->lights();
+    scene.primitive_count = flat_scene->sphere_count();
+    scene.material_count = flat_scene->material_count();
+  } else {
+    loader.load_geometry = true;
+    if (!loader.load(scene_file, scene)) {
+      return false;
+    }
+    auto build_start = std::chrono::steady_clock::now();
+    flat_scene->build(scene.spheres);
+    world.build_seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - build_start)
+                              .count();
+    // Scenes with materials the cache can not hold, such as image textures,
+    // are not saved.
+    if (use_scene_cache) {
+      flat_scene->save(cache_file, scene.geometry_hash);
+    }
+    scene.spheres = SphereStore();
+  }
+
+  // Meshes and moving spheres are not cached and sit next to the spheres at
+  // the top level.
+  if (flat_scene->sphere_count() > 0) {
+    scene.objects.add(flat_scene);
+  }
+  for (const auto& mesh : scene.meshes) {
+    scene.objects.add(mesh);
+  }
+  if (scene.moving) {
+    scene.objects.add(scene.moving);
+  }
+
+  world.background =
+      scene.environment_file.empty()
+          ? std::make_unique<EnvironmentMap>(scene.background)
+          : std::make_unique<EnvironmentMap>(scene.environment_file,
+                                             scene.environment_intensity);
+  world.lights = std::make_unique<LightTree>(scene.lights);
+
+  world.mapped = cached;
+  world.load_seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - load_start)
+                           .count();
+  return true;
+}
+
+/// @brief What ray_color needs to render world with a camera of the given
+/// field of view at the given image height.
+inline RenderContext make_context(const World& world,
+                                  const EnvironmentMap& background,
+                                  double vfov, int image_height,
+                                  PathGuide* guide) {
+  RenderContext context{world.scene.objects, background, *world.lights, guide};
+  context.pixel_spread =
+      2 * std::tan(degrees_to_radians(vfov) / 2) / image_height;
+  context.diffuse_spread = 0.1;
+  return context;
+}
+
+#endif  // _RAY_TRACING_LIB_WORLD_HPP_
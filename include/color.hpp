@@ -23,4 +23,9 @@ void write_color(std::ostream &out, Color pixel_color, int samples_per_pixel) {
       << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 }
 
+/// @brief Relative luminance of a linear Color (Rec. 709 weights).
+inline double luminance(const Color &c) {
+  return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 #endif